@@ -13,6 +13,22 @@
 				'src/tag.cc',
 				'src/remote.cc',
 				'src/index.cc',
+				'src/status.cc',
+				'src/checkout.cc',
+				'src/progress.cc',
+				'src/refs.cc',
+				'src/refwatch.cc',
+				'src/workqueue.cc',
+				'src/indexer.cc',
+				'src/sha1.cc',
+				'src/transfer.cc',
+				'src/packer.cc',
+				'src/packstream.cc',
+				'src/bundle.cc',
+				'src/scheduler.cc',
+				'src/pool.cc',
+				'src/objectcache.cc',
+				'src/iterator.cc',
 			],
 			'todosources': [
 				'src/index_entry.cc',
@@ -28,7 +44,8 @@
 
 			'libraries': [
 				'-L<!(pwd)/deps/libgit2/build',
-				'-lgit2'
+				'-lgit2',
+				'-lz'
 			],
 
 			'cflags': [
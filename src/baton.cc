@@ -1,12 +1,12 @@
 #include "baton.h"
 #include "gitteh.h"
+#include "scheduler.h"
 #include <iostream>
 
 namespace gitteh {
 
 Baton::Baton() {
-	errorCode = 0;
-	req.data = this;
+	init();
 }
 
 Baton::~Baton() {
@@ -16,6 +16,27 @@ Baton::~Baton() {
 	}
 }
 
+void Baton::reset() {
+	if(!callback.IsEmpty()) {
+		callback.Dispose();
+		callback.Clear();
+	}
+	errorString.clear();
+	init();
+}
+
+void Baton::init() {
+	errorCode = 0;
+	priority = Scheduler::CurrentPriority();
+	id = 0;
+	cancelCode = 0;
+	int timeout = Scheduler::CurrentTimeout();
+	deadline = timeout > 0 ? uv_hrtime() + (uint64_t)timeout * 1000000 : 0;
+	work = NULL;
+	after = NULL;
+	req.data = this;
+}
+
 void Baton::setCallback(Handle<Value> val) {
 	HandleScope scope;
 
@@ -31,6 +52,11 @@ void Baton::setError(const git_error *err) {
 	errorString = string(err->message);
 }
 
+void Baton::setError(int code, const string &message) {
+	errorCode = code;
+	errorString = message;
+}
+
 Handle<Object> Baton::createV8Error() {
 	HandleScope scope;
 
@@ -54,4 +80,24 @@ void Baton::defaultCallback() {
 	}
 }
 
+static int CancelCode(Baton *baton) {
+	int code = baton->cancelCode;
+	if(code == 0 && baton->deadline != 0 && uv_hrtime() >= baton->deadline) {
+		code = GITTEH_ETIMEDOUT;
+	}
+	return code;
+}
+
+bool Baton::isCancelled() {
+	return CancelCode(this) != 0;
+}
+
+bool Baton::cancelPoint() {
+	int code = CancelCode(this);
+	if(code == 0) return false;
+	if(code == GITTEH_ETIMEDOUT) setError(code, "Request timed out.");
+	else setError(code, "Request was cancelled.");
+	return true;
+}
+
 }; // namespace gitteh
@@ -10,6 +10,16 @@ using namespace v8;
 using std::string;
 
 namespace gitteh {
+// Error codes of gitteh's own, kept clear of libgit2's error classes.
+enum {
+	GITTEH_ECANCELLED = 1000,
+	GITTEH_ETIMEDOUT,
+	// Raised from JS, by a repository that's at its limits.
+	GITTEH_EBUSY,
+	// Raised from JS, by a repository that has been closed.
+	GITTEH_ECLOSED
+};
+
 /**
 	A Baton class specifically for libgit2 work.
 	Users of this Baton are expected to copy a git_error into this class.
@@ -20,16 +30,38 @@ public:
 	Persistent<Function> callback;
 	int errorCode;
 	string errorString;
+	// Lane the Scheduler runs this in, and the work it runs.
+	int priority;
+	uv_work_cb work;
+	uv_after_work_cb after;
+	// Identifies the request to Scheduler::Cancel.
+	unsigned int id;
+	// Set from the main thread once the request has been given up on.
+	volatile int cancelCode;
+	// uv_hrtime() after which the request has timed out, 0 for never.
+	uint64_t deadline;
 
 	Baton();
 	~Baton();
+	// Back to the state of a new Baton, for reuse by a BatonPool. Strings
+	// keep their buffers.
+	void reset();
 	void setCallback(Handle<Value> val);
 	bool isErrored();
 	void setError(const git_error *err);
+	// For errors raised by gitteh itself rather than libgit2.
+	void setError(int code, const string &message);
 	// Creates an Exception for this error state Baton. DON'T CALL OUTSIDE OF
 	// V8 MAIN THREAD! :)
 	Handle<Object> createV8Error();
 	void defaultCallback();
+	bool isCancelled();
+	// Checkpoint for long running work: when the request has been cancelled
+	// or is past its deadline, errors out the baton and returns true.
+	bool cancelPoint();
+
+private:
+	void init();
 };
 
 }; // namespace gitteh
@@ -0,0 +1,157 @@
+#include "bundle.h"
+#include "repository.h"
+#include "transfer.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+using std::pair;
+using std::vector;
+
+namespace gitteh {
+	namespace Bundle {
+		static const char SIGNATURE[] = "# v2 git bundle";
+
+		static bool Fail(Baton *baton, int code, const string &message) {
+			baton->setError(code, message);
+			return false;
+		}
+
+		static string FormatOid(const git_oid &oid) {
+			char hex[GIT_OID_HEXSZ + 1];
+			hex[GIT_OID_HEXSZ] = 0;
+			git_oid_fmt(hex, &oid);
+			return hex;
+		}
+
+		/**
+			Puts the header in front of the pack. The prerequisites are only
+			known once the Packer has walked the history, which it does
+			before writing anything, so the header goes out with the first
+			write.
+		*/
+		class HeaderSink : public Packer::Sink {
+		public:
+			HeaderSink(Packer::Sink *sink, const Header *header) : sink_(sink),
+					header_(header), written_(0), started_(false) { }
+
+			bool write(const char *data, size_t len) {
+				if(!started_) {
+					started_ = true;
+					string header = string(SIGNATURE) + "\n";
+					for(size_t i = 0; i < header_->prerequisites.size(); i++) {
+						header += "-" + FormatOid(header_->prerequisites[i]) + "\n";
+					}
+					for(size_t i = 0; i < header_->refs.size(); i++) {
+						header += FormatOid(header_->refs[i].second) + " " +
+								header_->refs[i].first + "\n";
+					}
+					header += "\n";
+					written_ = header.size();
+					if(!sink_->write(header.data(), header.size())) return false;
+				}
+				return sink_->write(data, len);
+			}
+
+			size_t written() const {
+				return written_;
+			}
+
+		private:
+			Packer::Sink *sink_;
+			const Header *header_;
+			size_t written_;
+			bool started_;
+		};
+
+		bool Create(Repository *repo, const vector<string> &refNames,
+				Packer::Options options, Packer::Sink *sink, Progress *progress,
+				Packer::Result *result, Baton *baton) {
+			Header header;
+
+			repo->lockRefs();
+			for(size_t i = 0; i < refNames.size(); i++) {
+				git_oid oid;
+				if(!Transfer::ResolveRef(repo->repo_, refNames[i].c_str(), &oid)) {
+					repo->unlockRefs();
+					return Fail(baton, GITERR_REFERENCE, "Reference '" +
+							refNames[i] + "' not found.");
+				}
+				header.refs.push_back(pair<string, git_oid>(refNames[i], oid));
+			}
+			repo->unlockRefs();
+
+			options.wants.clear();
+			for(size_t i = 0; i < header.refs.size(); i++) {
+				options.wants.push_back(header.refs[i].second);
+			}
+			options.boundary = &header.prerequisites;
+
+			HeaderSink headerSink(sink, &header);
+			if(!Packer::Run(repo, options, &headerSink, progress, result, baton)) {
+				return false;
+			}
+			result->bytes += headerSink.written();
+			return true;
+		}
+
+		bool ReadHeader(const string &path, Header *header, off_t *packOffset,
+				Baton *baton) {
+			FILE *file = fopen(path.c_str(), "rb");
+			if(file == NULL) {
+				return Fail(baton, GITERR_OS, "Failed to open '" + path + "'.");
+			}
+
+			char *line = NULL;
+			size_t capacity = 0;
+			ssize_t len;
+			bool first = true, ended = false, ok = true;
+			while(ok && !ended && (len = getline(&line, &capacity, file)) > 0) {
+				string text(line, len);
+				if(text[text.size() - 1] == '\n') text.resize(text.size() - 1);
+
+				if(first) {
+					first = false;
+					if(text != SIGNATURE) {
+						ok = Fail(baton, GITERR_INVALID, "'" + path +
+								"' is not a version 2 git bundle.");
+					}
+					continue;
+				}
+				if(text.empty()) {
+					ended = true;
+					continue;
+				}
+
+				bool prerequisite = text[0] == '-';
+				string rest = prerequisite ? text.substr(1) : text;
+				git_oid oid;
+				// Prerequisites may be followed by a comment, refs have to be
+				// followed by their name.
+				if(rest.size() < GIT_OID_HEXSZ ||
+						git_oid_fromstrn(&oid, rest.c_str(), GIT_OID_HEXSZ) != GIT_OK ||
+						(rest.size() > GIT_OID_HEXSZ && rest[GIT_OID_HEXSZ] != ' ') ||
+						(!prerequisite && rest.size() < GIT_OID_HEXSZ + 2)) {
+					ok = Fail(baton, GITERR_INVALID, "Malformed bundle header line '" +
+							text + "'.");
+					continue;
+				}
+				if(prerequisite) {
+					header->prerequisites.push_back(oid);
+				}
+				else {
+					header->refs.push_back(pair<string, git_oid>(
+							rest.substr(GIT_OID_HEXSZ + 1), oid));
+				}
+			}
+			free(line);
+			giterr_clear();
+
+			if(ok && !ended) {
+				ok = Fail(baton, GITERR_INVALID, "Truncated bundle header.");
+			}
+			if(ok) *packOffset = ftello(file);
+			fclose(file);
+			return ok;
+		}
+	};
+}; // namespace gitteh
@@ -0,0 +1,40 @@
+#ifndef GITTEH_BUNDLE_H
+#define GITTEH_BUNDLE_H
+
+#include "gitteh.h"
+#include "packer.h"
+#include <utility>
+#include <vector>
+
+namespace gitteh {
+	class Repository;
+	class Progress;
+
+	/**
+		Git bundles (version 2): a header listing the commits the receiving
+		side needs to have already (prerequisites) and the refs being sent,
+		followed by a plain pack.
+	*/
+	namespace Bundle {
+		struct Header {
+			std::vector<git_oid> prerequisites;
+			std::vector<std::pair<string, git_oid> > refs;
+		};
+
+		/**
+			Resolves refNames (HEAD or full ref names) under the refs lock
+			and writes a bundle of them to sink, through the Packer. The
+			prerequisites are the commits from options.haves that the pack
+			stops at. Packs written by gitteh are never thin, so the bundle
+			can be unbundled without them, they're just listed.
+		*/
+		bool Create(Repository*, const std::vector<string> &refNames,
+				Packer::Options options, Packer::Sink*, Progress*,
+				Packer::Result*, Baton*);
+
+		// Parses the header of the bundle at path, and where its pack starts.
+		bool ReadHeader(const string &path, Header*, off_t *packOffset, Baton*);
+	};
+}; // namespace gitteh
+
+#endif // GITTEH_BUNDLE_H
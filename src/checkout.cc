@@ -0,0 +1,373 @@
+#include "checkout.h"
+#include "repository.h"
+#include "progress.h"
+#include "workqueue.h"
+#include <algorithm>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+using std::vector;
+
+namespace gitteh {
+	namespace Checkout {
+		// How many files a single job writes.
+		static const size_t CHUNK_SIZE = 32;
+
+		// Mode of submodule entries in trees.
+		static const unsigned int GITLINK_MODE = 0160000;
+
+		struct CheckoutEntry {
+			string path;
+			git_oid oid;
+			unsigned int mode;
+			size_t size;
+			struct stat st;
+		};
+
+		struct CheckoutState {
+			Repository *repo;
+			string root;
+			vector<CheckoutEntry> entries;
+			Progress *progress;
+			// Only checked for cancellation.
+			Baton *baton;
+
+			gitteh_lock lock;
+			bool failed;
+			int errorCode;
+			string errorMessage;
+
+			// Records the first error, and tells the other jobs to give up.
+			void fail(int code, const string &message) {
+				LOCK_MUTEX(lock);
+				if(!failed) {
+					failed = true;
+					errorCode = code;
+					errorMessage = message;
+				}
+				UNLOCK_MUTEX(lock);
+			}
+
+			bool isFailed() {
+				LOCK_MUTEX(lock);
+				bool result = failed;
+				UNLOCK_MUTEX(lock);
+				return result;
+			}
+		};
+
+		struct WriteJob {
+			CheckoutState *state;
+			size_t start;
+			size_t end;
+		};
+
+		// A tree can be built by hand, and names that aren't a single path
+		// component (or that lead into .git) would write outside of the
+		// checkout. git refuses these too.
+		static bool IsSafeName(const char *name) {
+			if(!*name || !strcmp(name, ".") || !strcmp(name, "..") ||
+					!strcasecmp(name, ".git")) {
+				return false;
+			}
+			return strchr(name, '/') == NULL;
+		}
+
+		static bool CollectTree(Repository *repo, git_tree *tree,
+				const string &prefix, CheckoutState *state, vector<string> *dirs,
+				Baton *baton) {
+			unsigned int count = git_tree_entrycount(tree);
+			const char *previous = NULL;
+			for(unsigned int i = 0; i < count; i++) {
+				const git_tree_entry *entry = git_tree_entry_byindex(tree, i);
+				const char *name = git_tree_entry_name(entry);
+				string path = prefix + name;
+
+				// Entries are sorted, so the same name twice (say a symlink and
+				// a directory) would be next to each other.
+				if(!IsSafeName(name) || (previous && !strcmp(previous, name))) {
+					baton->setError(GITERR_TREE,
+							"Refusing to check out invalid path '" + path + "'");
+					return false;
+				}
+				previous = name;
+
+				if(git_tree_entry_type(entry) == GIT_OBJ_TREE) {
+					dirs->push_back(path);
+
+					git_tree *subtree;
+					if(!AsyncLibCall(git_tree_lookup(&subtree, repo->repo_,
+							git_tree_entry_id(entry)), baton)) {
+						return false;
+					}
+					bool ok = CollectTree(repo, subtree, path + "/", state, dirs,
+							baton);
+					git_tree_free(subtree);
+					if(!ok) return false;
+					continue;
+				}
+
+				CheckoutEntry checkoutEntry;
+				checkoutEntry.path = path;
+				checkoutEntry.oid = *git_tree_entry_id(entry);
+				checkoutEntry.mode = git_tree_entry_attributes(entry);
+				checkoutEntry.size = 0;
+				memset(&checkoutEntry.st, 0, sizeof(struct stat));
+				state->entries.push_back(checkoutEntry);
+
+				// Submodules just get an empty directory, like git does.
+				if((checkoutEntry.mode & S_IFMT) == GITLINK_MODE) {
+					dirs->push_back(path);
+				}
+			}
+			return true;
+		}
+
+		static bool MakeDirectory(const string &path) {
+			return mkdir(path.c_str(), 0777) == 0 || errno == EEXIST;
+		}
+
+		static bool MakeRoot(const string &root) {
+			for(size_t i = 1; i < root.size(); i++) {
+				if(root[i] == '/' && !MakeDirectory(root.substr(0, i))) {
+					return false;
+				}
+			}
+			return MakeDirectory(root);
+		}
+
+		static bool WriteFile(const string &path, const char *data, size_t len,
+				mode_t mode) {
+			int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, mode);
+			if(fd < 0) return false;
+
+			while(len > 0) {
+				ssize_t written = write(fd, data, len);
+				if(written < 0) {
+					if(errno == EINTR) continue;
+					close(fd);
+					return false;
+				}
+				data += written;
+				len -= written;
+			}
+
+			return close(fd) == 0;
+		}
+
+		static bool WriteEntry(CheckoutState *state, CheckoutEntry &entry) {
+			if((entry.mode & S_IFMT) == GITLINK_MODE) return true;
+
+			Repository *repo = state->repo;
+			git_odb_object *blob;
+
+			// Only the odb read needs the lock (shared with the other
+			// writers), writing is where the parallelism pays off.
+			repo->lockObjects();
+			if(git_odb_read(&blob, repo->odb_, &entry.oid) != GIT_OK) {
+				const git_error *err = giterr_last();
+				state->fail(err->klass, err->message);
+				repo->unlockObjects();
+				return false;
+			}
+			repo->unlockObjects();
+
+			const char *data = static_cast<const char*>(git_odb_object_data(blob));
+			entry.size = git_odb_object_size(blob);
+			string fullPath = state->root + entry.path;
+
+			// Don't write through whatever might already be sitting there.
+			unlink(fullPath.c_str());
+
+			bool ok;
+			if(S_ISLNK(entry.mode)) {
+				string target(data, entry.size);
+				ok = symlink(target.c_str(), fullPath.c_str()) == 0;
+			}
+			else {
+				ok = WriteFile(fullPath, data, entry.size,
+						(entry.mode & 0111) ? 0755 : 0644);
+			}
+
+			repo->lockObjects();
+			git_odb_object_free(blob);
+			repo->unlockObjects();
+
+			if(!ok || lstat(fullPath.c_str(), &entry.st) < 0) {
+				state->fail(GITERR_OS, "Failed to write '" + fullPath + "'");
+				return false;
+			}
+			return true;
+		}
+
+		static void WriteEntries(void *data) {
+			WriteJob *job = static_cast<WriteJob*>(data);
+			CheckoutState *state = job->state;
+
+			for(size_t i = job->start; i < job->end; i++) {
+				if(state->isFailed() || state->baton->isCancelled()) break;
+
+				CheckoutEntry &entry = state->entries[i];
+				if(!WriteEntry(state, entry)) break;
+
+				if(state->progress) {
+					state->progress->add(PROGRESS_DONE, 1);
+					state->progress->add(PROGRESS_BYTES, entry.size);
+					state->progress->notify();
+				}
+			}
+
+			delete job;
+		}
+
+		static bool IsWorkdir(Repository *repo, const string &path) {
+			const char *workdir = git_repository_workdir(repo->repo_);
+			if(workdir == NULL) return false;
+
+			char a[PATH_MAX], b[PATH_MAX];
+			if(realpath(workdir, a) == NULL || realpath(path.c_str(), b) == NULL) {
+				return false;
+			}
+			return !strcmp(a, b);
+		}
+
+		static bool UpdateIndex(CheckoutState *state, Baton *baton) {
+			// The new entries are built up in an index of their own, so a
+			// failure part way leaves the repository's index as it was.
+			// Appending (rather than a lookup + insert per entry) is safe as
+			// it's built from scratch, it's sorted on write.
+			string indexPath = string(git_repository_path(state->repo->repo_)) +
+					"index";
+			string newPath = indexPath + ".checkout";
+			unlink(newPath.c_str());
+			git_index *index;
+			if(!AsyncLibCall(git_index_open(&index, newPath.c_str()), baton)) {
+				return false;
+			}
+
+			bool ok = true;
+			for(size_t i = 0; ok && i < state->entries.size(); i++) {
+				CheckoutEntry &entry = state->entries[i];
+				const struct stat &st = entry.st;
+
+				git_index_entry indexEntry;
+				memset(&indexEntry, 0, sizeof(git_index_entry));
+				indexEntry.ctime.seconds = st.st_ctime;
+				indexEntry.mtime.seconds = st.st_mtime;
+				indexEntry.dev = st.st_dev;
+				indexEntry.ino = st.st_ino;
+				indexEntry.mode = entry.mode;
+				indexEntry.uid = st.st_uid;
+				indexEntry.gid = st.st_gid;
+				indexEntry.file_size = st.st_size;
+				indexEntry.oid = entry.oid;
+				indexEntry.path = const_cast<char*>(entry.path.c_str());
+
+				ok = AsyncLibCall(git_index_append2(index, &indexEntry), baton);
+			}
+
+			if(ok) ok = AsyncLibCall(git_index_write(index), baton);
+			git_index_free(index);
+			if(ok && rename(newPath.c_str(), indexPath.c_str()) < 0) {
+				baton->setError(GITERR_OS, "Failed to replace '" + indexPath + "'");
+				ok = false;
+			}
+			if(!ok) {
+				unlink(newPath.c_str());
+				return false;
+			}
+
+			// Clearing also forgets the mtime, so the file just swapped in is
+			// read even if it was written in the same second as the last one.
+			git_index_clear(state->repo->index_);
+			return AsyncLibCall(git_index_read(state->repo->index_), baton);
+		}
+
+		bool Run(Repository *repo, const git_oid &treeId, const string &path,
+				int threads, Progress *progress, Result *result, Baton *baton) {
+			CheckoutState state;
+			state.repo = repo;
+			state.root = path;
+			state.progress = progress;
+			state.baton = baton;
+			state.failed = false;
+			state.errorCode = 0;
+			if(state.root.empty() || state.root[state.root.size() - 1] != '/') {
+				state.root += "/";
+			}
+
+			vector<string> dirs;
+			git_tree *tree;
+			repo->lockObjects();
+			bool ok = AsyncLibCall(git_tree_lookup(&tree, repo->repo_, &treeId),
+					baton);
+			if(ok) {
+				ok = CollectTree(repo, tree, "", &state, &dirs, baton);
+				git_tree_free(tree);
+			}
+			repo->unlockObjects();
+			if(!ok) return false;
+
+			if(progress) {
+				progress->set(PROGRESS_TOTAL, state.entries.size());
+				progress->notify();
+			}
+
+			// Directories are listed parents first, so creating them in order
+			// means the write jobs never have to care.
+			if(!MakeRoot(state.root)) {
+				baton->setError(GITERR_OS, "Failed to create '" + state.root + "'");
+				return false;
+			}
+			for(size_t i = 0; i < dirs.size(); i++) {
+				if(!MakeDirectory(state.root + dirs[i])) {
+					baton->setError(GITERR_OS, "Failed to create '" +
+							state.root + dirs[i] + "'");
+					return false;
+				}
+			}
+
+			WorkQueue queue(threads);
+			CREATE_MUTEX(state.lock);
+			for(size_t i = 0; i < state.entries.size(); i += CHUNK_SIZE) {
+				WriteJob *job = new WriteJob;
+				job->state = &state;
+				job->start = i;
+				job->end = std::min(i + CHUNK_SIZE, state.entries.size());
+				queue.push(WriteEntries, job);
+			}
+			queue.run();
+			DESTROY_MUTEX(state.lock);
+
+			if(baton->cancelPoint()) return false;
+			if(state.failed) {
+				baton->setError(state.errorCode, state.errorMessage);
+				return false;
+			}
+
+			result->files = 0;
+			result->bytes = 0;
+			for(size_t i = 0; i < state.entries.size(); i++) {
+				if((state.entries[i].mode & S_IFMT) == GITLINK_MODE) continue;
+				result->files++;
+				result->bytes += state.entries[i].size;
+			}
+
+			if(IsWorkdir(repo, state.root)) {
+				repo->lockIndex();
+				ok = UpdateIndex(&state, baton);
+				repo->unlockIndex();
+			}
+
+			return ok;
+		}
+	};
+}; // namespace gitteh
@@ -0,0 +1,38 @@
+#ifndef GITTEH_CHECKOUT_H
+#define GITTEH_CHECKOUT_H
+
+#include "gitteh.h"
+
+namespace gitteh {
+	class Repository;
+	class Progress;
+
+	namespace Checkout {
+		// Fields reported through Progress, in callback argument order.
+		enum {
+			PROGRESS_DONE,
+			PROGRESS_TOTAL,
+			PROGRESS_BYTES,
+			PROGRESS_FIELDS
+		};
+
+		struct Result {
+			unsigned int files;
+			double bytes;
+		};
+
+		/**
+			Writes out the tree with provided id into path. The tree is listed
+			and every directory created up front, then blobs are read from the
+			odb and written on `threads` native threads, one blob in memory per
+			thread at a time. If path is the repository's working directory the
+			index is rebuilt from the written files (with stat data) and saved.
+			Must be called from a worker thread, without any repository lock held.
+			progress may be NULL.
+		*/
+		bool Run(Repository*, const git_oid &treeId, const string &path,
+				int threads, Progress*, Result*, Baton*);
+	};
+}; // namespace gitteh
+
+#endif // GITTEH_CHECKOUT_H
@@ -31,6 +31,12 @@
 #include "tag.h"
 #include "remote.h"
 #include "index.h"
+#include "status.h"
+#include "refwatch.h"
+#include "packstream.h"
+#include "scheduler.h"
+#include "pool.h"
+#include "iterator.h"
 
 namespace gitteh {
 
@@ -61,8 +67,14 @@ init(Handle<Object> target) {
 	Blob::Init(target);
 	Tag::Init(target);
 	Index::Init(target);
+	Status::Init(target);
 
 	Remote::Init(target);
+	RefWatcher::Init(target);
+	PackStream::Init(target);
+	Scheduler::Init(target);
+	BatonPoolBase::Init(target);
+	Iterator::Init(target);
 
 	ImmutableSet(target, String::NewSymbol("minOidLength"), Integer::New(GIT_OID_MINPREFIXLEN));
 	ImmutableSet(target, String::NewSymbol("types"), CreateTypeObject());
@@ -1,6 +1,10 @@
 #include "index.h"
 #include "baton.h"
 #include "repository.h"
+#include "status.h"
+#include "scheduler.h"
+
+using std::vector;
 
 namespace gitteh {
 	static Persistent<String> class_symbol;
@@ -13,9 +17,11 @@ namespace gitteh {
 		IndexBaton(Index *index) : Baton(), index_(index) {
 			repository_ = index->repository_;
 			index_->Ref();
+			repository_->Ref();
 		}
 
 		~IndexBaton() {
+			repository_->Unref();
 			index_->Unref();
 		}
 	};
@@ -27,6 +33,16 @@ namespace gitteh {
 		ReadTreeBaton(Index *index) : IndexBaton(index)  { }
 	};
 
+	class StatusBaton : public IndexBaton {
+	public:
+		vector<string> pathspecs;
+		bool untracked;
+		int threads;
+		Status::Result result;
+
+		StatusBaton(Index *index) : IndexBaton(index) { }
+	};
+
 	Persistent<FunctionTemplate> Index::constructor_template;
 
 	Index::Index(Repository *repository, git_index *index) : 
@@ -50,6 +66,7 @@ namespace gitteh {
 
 		NODE_SET_PROTOTYPE_METHOD(t, "readTree", ReadTree);
 		NODE_SET_PROTOTYPE_METHOD(t, "write", Write);
+		NODE_SET_PROTOTYPE_METHOD(t, "status", GetStatus);
 
 		module->Set(class_symbol, constructor_template->GetFunction());
 	}
@@ -76,8 +93,7 @@ namespace gitteh {
 		baton->treeId = CastFromJS<git_oid>(args[0]);
 		baton->setCallback(args[1]);
 
-		uv_queue_work(uv_default_loop(), &baton->req, AsyncReadTree,
-				AsyncAfterReadTree);
+		Scheduler::Queue(baton, AsyncReadTree, AsyncAfterReadTree);
 
 		return Undefined();
 	}
@@ -85,7 +101,8 @@ namespace gitteh {
 	void Index::AsyncReadTree(uv_work_t *req) {
 		ReadTreeBaton *baton = GetBaton<ReadTreeBaton>(req);
 
-		baton->repository_->lockRepository();
+		baton->repository_->lockIndex();
+		baton->repository_->lockObjects();
 
 		git_tree *tree;
 		if(AsyncLibCall(git_tree_lookup(&tree, baton->repository_->repo_,
@@ -95,7 +112,8 @@ namespace gitteh {
 			git_tree_free(tree);
 		}
 
-		baton->repository_->unlockRepository();
+		baton->repository_->unlockObjects();
+		baton->repository_->unlockIndex();
 	}
 
 	void Index::AsyncAfterReadTree(uv_work_t *req) {
@@ -113,8 +131,7 @@ namespace gitteh {
 		IndexBaton *baton = new IndexBaton(index);
 		baton->setCallback(args[0]);
 
-		uv_queue_work(uv_default_loop(), &baton->req, AsyncWrite, 
-				AsyncAfterWrite);
+		Scheduler::Queue(baton, AsyncWrite, AsyncAfterWrite);
 
 		return Undefined();
 	}
@@ -122,7 +139,9 @@ namespace gitteh {
 	void Index::AsyncWrite(uv_work_t *req) {
 		IndexBaton *baton = GetBaton<IndexBaton>(req);
 
+		baton->repository_->lockIndex();
 		AsyncLibCall(git_index_write(baton->index_->index_), baton);
+		baton->repository_->unlockIndex();
 	}
 
 	void Index::AsyncAfterWrite(uv_work_t *req) {
@@ -134,4 +153,44 @@ namespace gitteh {
 		delete baton;
 	}
 
+	Handle<Value> Index::GetStatus(const Arguments &args) {
+		HandleScope scope;
+		Index *index = ObjectWrap::Unwrap<Index>(args.This());
+
+		StatusBaton *baton = new StatusBaton(index);
+		baton->pathspecs = CastFromJS<vector<string> >(args[0]);
+		baton->untracked = CastFromJS<bool>(args[1]);
+		baton->threads = CastFromJS<int>(args[2]);
+		baton->setCallback(args[3]);
+
+		Scheduler::Queue(baton, AsyncGetStatus, AsyncAfterGetStatus);
+
+		return Undefined();
+	}
+
+	void Index::AsyncGetStatus(uv_work_t *req) {
+		StatusBaton *baton = GetBaton<StatusBaton>(req);
+
+		Status::Scan(baton->repository_, baton->index_->index_,
+				baton->pathspecs, baton->untracked, baton->threads,
+				&baton->result, baton);
+	}
+
+	void Index::AsyncAfterGetStatus(uv_work_t *req) {
+		HandleScope scope;
+		StatusBaton *baton = GetBaton<StatusBaton>(req);
+
+		if(baton->isErrored()) {
+			Handle<Value> argv[] = { baton->createV8Error() };
+			FireCallback(baton->callback, 1, argv);
+		}
+		else {
+			Handle<Value> argv[] = { Undefined(),
+				CastToJS(baton->result.paths), CastToJS(baton->result.flags) };
+			FireCallback(baton->callback, 3, argv);
+		}
+
+		delete baton;
+	}
+
 }; // namespace gitteh
@@ -20,6 +20,7 @@ namespace gitteh {
 		static Handle<Value> New(const Arguments&);
 		static Handle<Value> ReadTree(const Arguments&);
 		static Handle<Value> Write(const Arguments&);
+		static Handle<Value> GetStatus(const Arguments&);
 	private:
 		Repository *repository_;
 		git_index *index_;
@@ -28,6 +29,8 @@ namespace gitteh {
 		static void AsyncAfterReadTree(uv_work_t*);
 		static void AsyncWrite(uv_work_t*);
 		static void AsyncAfterWrite(uv_work_t*);
+		static void AsyncGetStatus(uv_work_t*);
+		static void AsyncAfterGetStatus(uv_work_t*);
 	};
 
 } // namespace gitteh
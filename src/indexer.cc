@@ -0,0 +1,775 @@
+#include "indexer.h"
+#include "progress.h"
+#include "workqueue.h"
+#include "sha1.h"
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <cstdio>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <zlib.h>
+
+using std::vector;
+
+namespace gitteh {
+	namespace Indexer {
+		// Pack object types, as stored in object headers.
+		enum {
+			OBJ_COMMIT = 1,
+			OBJ_TREE = 2,
+			OBJ_BLOB = 3,
+			OBJ_TAG = 4,
+			OBJ_OFS_DELTA = 6,
+			OBJ_REF_DELTA = 7
+		};
+
+		// How many base objects (and their delta trees) a single job resolves.
+		static const size_t CHUNK_SIZE = 16;
+
+		static const uint32_t LARGE_OFFSET = 0x80000000;
+
+		struct PackObject {
+			uint64_t offset;
+			uint64_t dataOffset;
+			uint64_t end;
+			size_t size;
+			int type;
+			// Index of the base object, for OFS_DELTA.
+			uint32_t base;
+			// For REF_DELTA.
+			git_oid baseId;
+			uint32_t crc;
+
+			// Filled in when resolved.
+			git_otype realType;
+			git_oid oid;
+			bool resolved;
+		};
+
+		struct OidLess {
+			bool operator()(const git_oid &a, const git_oid &b) const {
+				return git_oid_cmp(&a, &b) < 0;
+			}
+		};
+
+		typedef std::map<git_oid, vector<uint32_t>, OidLess> RefChildMap;
+
+		struct IndexState {
+			const unsigned char *data;
+			size_t size;
+			vector<PackObject> objects;
+			// Children of object i (OFS_DELTA) are
+			// ofsChildren[ofsStart[i] .. ofsStart[i + 1]).
+			vector<uint32_t> ofsStart;
+			vector<uint32_t> ofsChildren;
+			RefChildMap refChildren;
+			Progress *progress;
+			WorkQueue *queue;
+
+			gitteh_lock lock;
+			bool failed;
+			int errorCode;
+			string errorMessage;
+
+			void fail(int code, const string &message) {
+				LOCK_MUTEX(lock);
+				if(!failed) {
+					failed = true;
+					errorCode = code;
+					errorMessage = message;
+				}
+				UNLOCK_MUTEX(lock);
+			}
+
+			bool isFailed() {
+				LOCK_MUTEX(lock);
+				bool result = failed;
+				UNLOCK_MUTEX(lock);
+				return result;
+			}
+		};
+
+		// Inflated (and undeltified) contents of a resolved object, shared by
+		// the jobs resolving the deltas against it.
+		struct ObjectData {
+			uint32_t index;
+			vector<unsigned char> bytes;
+			int refs;
+		};
+
+		struct ResolveJob {
+			IndexState *state;
+			vector<uint32_t> bases;
+		};
+
+		struct DeltaJob {
+			IndexState *state;
+			uint32_t index;
+			ObjectData *base;
+		};
+
+		struct ChecksumJob {
+			IndexState *state;
+		};
+
+		// A delta waiting to be resolved against base, on ResolveChildren's
+		// stack.
+		struct Pending {
+			uint32_t index;
+			ObjectData *base;
+		};
+
+		static const unsigned char *Bytes(const vector<unsigned char> &buf) {
+			return buf.empty() ? NULL : &buf[0];
+		}
+
+		/**
+			Inflates the zlib stream at in, which must come out at exactly
+			size bytes. If out is NULL the output goes to scratch and is thrown
+			away, which is how the end of each object is found. used receives
+			the compressed length.
+		*/
+		static bool Inflate(const unsigned char *in, size_t avail,
+				unsigned char *out, size_t size, vector<unsigned char> *scratch,
+				size_t *used) {
+			z_stream stream;
+			memset(&stream, 0, sizeof(z_stream));
+			if(inflateInit(&stream) != Z_OK) return false;
+
+			stream.next_in = const_cast<unsigned char*>(in);
+			stream.avail_in = avail > 0xffffffff ? 0xffffffff : (uInt)avail;
+
+			// Anything written past size lands in spill and fails the check.
+			unsigned char spill[1];
+			size_t total = 0;
+			int status;
+			do {
+				if(out && total < size) {
+					stream.next_out = out + total;
+					stream.avail_out = (uInt)(size - total);
+				}
+				else if(!out) {
+					stream.next_out = &(*scratch)[0];
+					stream.avail_out = scratch->size();
+				}
+				else {
+					stream.next_out = spill;
+					stream.avail_out = sizeof(spill);
+				}
+				uInt before = stream.avail_out;
+				status = inflate(&stream, Z_NO_FLUSH);
+				total += before - stream.avail_out;
+			} while(status == Z_OK && total <= size);
+
+			*used = stream.total_in;
+			inflateEnd(&stream);
+			return status == Z_STREAM_END && total == size;
+		}
+
+		static bool ReadObject(IndexState *state, const PackObject &object,
+				vector<unsigned char> *out) {
+			out->resize(object.size);
+			vector<unsigned char> none(1);
+			size_t used;
+			return Inflate(state->data + object.dataOffset,
+					object.end - object.dataOffset,
+					out->empty() ? NULL : &(*out)[0], object.size, &none, &used);
+		}
+
+		static bool DeltaSize(const unsigned char **pos, const unsigned char *end,
+				size_t *size) {
+			*size = 0;
+			int shift = 0;
+			unsigned char c;
+			do {
+				if(*pos >= end || shift > 56) return false;
+				c = *(*pos)++;
+				*size |= (size_t)(c & 0x7f) << shift;
+				shift += 7;
+			} while(c & 0x80);
+			return true;
+		}
+
+		// Standard git delta: source and target size, then copy/insert ops.
+		static bool ApplyDelta(const vector<unsigned char> &base,
+				const vector<unsigned char> &delta, vector<unsigned char> *out) {
+			const unsigned char *pos = Bytes(delta);
+			const unsigned char *end = pos + delta.size();
+
+			size_t baseSize, resultSize;
+			if(!DeltaSize(&pos, end, &baseSize) || baseSize != base.size() ||
+					!DeltaSize(&pos, end, &resultSize)) {
+				return false;
+			}
+
+			out->resize(resultSize);
+			size_t written = 0;
+			while(pos < end) {
+				unsigned char cmd = *pos++;
+				if(cmd & 0x80) {
+					size_t offset = 0, len = 0;
+					for(int i = 0; i < 4; i++) {
+						if(cmd & (1 << i)) {
+							if(pos >= end) return false;
+							offset |= (size_t)*pos++ << (i * 8);
+						}
+					}
+					for(int i = 0; i < 3; i++) {
+						if(cmd & (0x10 << i)) {
+							if(pos >= end) return false;
+							len |= (size_t)*pos++ << (i * 8);
+						}
+					}
+					if(len == 0) len = 0x10000;
+					if(offset + len > base.size() || written + len > resultSize) {
+						return false;
+					}
+					memcpy(&(*out)[written], &base[offset], len);
+					written += len;
+				}
+				else if(cmd) {
+					if(pos + cmd > end || written + cmd > resultSize) return false;
+					memcpy(&(*out)[written], pos, cmd);
+					written += cmd;
+					pos += cmd;
+				}
+				else {
+					return false;
+				}
+			}
+			return written == resultSize;
+		}
+
+		static bool Hash(PackObject &object, const vector<unsigned char> &data) {
+			if(git_odb_hash(&object.oid, Bytes(data), data.size(),
+					object.realType) != GIT_OK) {
+				return false;
+			}
+			object.resolved = true;
+			return true;
+		}
+
+		static void ReportResolved(IndexState *state) {
+			if(!state->progress) return;
+			state->progress->add(PROGRESS_DONE, 1);
+			state->progress->notify();
+		}
+
+		static void Release(IndexState *state, ObjectData *data) {
+			LOCK_MUTEX(state->lock);
+			bool last = --data->refs == 0;
+			UNLOCK_MUTEX(state->lock);
+			if(last) delete data;
+		}
+
+		/**
+			Applies delta index to base. Returns the result, with one reference
+			for the caller, or NULL (and fails the state) if it's broken.
+		*/
+		static ObjectData *ResolveDelta(IndexState *state, uint32_t index,
+				ObjectData *base) {
+			PackObject &object = state->objects[index];
+			vector<unsigned char> delta;
+			ObjectData *result = new ObjectData;
+			result->refs = 1;
+			if(!ReadObject(state, object, &delta) ||
+					!ApplyDelta(base->bytes, delta, &result->bytes)) {
+				char message[64];
+				sprintf(message, "Bad delta at offset %llu.",
+						(unsigned long long)object.offset);
+				state->fail(GITERR_INDEXER, message);
+				Release(state, result);
+				return NULL;
+			}
+			delta.clear();
+
+			object.realType = state->objects[base->index].realType;
+			result->index = index;
+			if(!Hash(object, result->bytes)) {
+				state->fail(GITERR_INDEXER, "Failed to hash object.");
+				Release(state, result);
+				return NULL;
+			}
+			ReportResolved(state);
+			return result;
+		}
+
+		static void ResolveChildren(IndexState *state, uint32_t index,
+				ObjectData *data);
+
+		static void ResolveQueued(void *payload) {
+			DeltaJob *job = static_cast<DeltaJob*>(payload);
+			IndexState *state = job->state;
+			ObjectData *result = state->isFailed() ? NULL :
+					ResolveDelta(state, job->index, job->base);
+			Release(state, job->base);
+			if(result) ResolveChildren(state, job->index, result);
+			delete job;
+		}
+
+		/**
+			Hands out the deltas built on object index: the first goes on
+			stack, the others are queued so idle threads can pick them up.
+			They share data (and the caller's reference to it) until the last
+			one is done with it.
+		*/
+		static void PushChildren(IndexState *state, uint32_t index,
+				ObjectData *data, vector<Pending> *stack) {
+			const PackObject &object = state->objects[index];
+			vector<uint32_t> children(
+					state->ofsChildren.begin() + state->ofsStart[index],
+					state->ofsChildren.begin() + state->ofsStart[index + 1]);
+			RefChildMap::const_iterator refs = state->refChildren.find(object.oid);
+			if(refs != state->refChildren.end()) {
+				children.insert(children.end(), refs->second.begin(),
+						refs->second.end());
+			}
+			if(children.empty()) {
+				Release(state, data);
+				return;
+			}
+
+			for(size_t i = 1; i < children.size(); i++) {
+				DeltaJob *job = new DeltaJob;
+				job->state = state;
+				job->index = children[i];
+				job->base = data;
+				LOCK_MUTEX(state->lock);
+				data->refs++;
+				UNLOCK_MUTEX(state->lock);
+				state->queue->push(ResolveQueued, job);
+			}
+			Pending next = { children[0], data };
+			stack->push_back(next);
+		}
+
+		/**
+			Resolves everything built on object index, depth first, taking
+			over the caller's reference to its data. Delta chains can be
+			thousands of objects long, so they're followed on an explicit
+			stack rather than by recursing once per level, and each base is
+			let go as soon as its deltas are done with it.
+		*/
+		static void ResolveChildren(IndexState *state, uint32_t index,
+				ObjectData *data) {
+			vector<Pending> stack;
+			PushChildren(state, index, data, &stack);
+			while(!stack.empty()) {
+				Pending next = stack.back();
+				stack.pop_back();
+				ObjectData *result = state->isFailed() ? NULL :
+						ResolveDelta(state, next.index, next.base);
+				Release(state, next.base);
+				if(result) PushChildren(state, next.index, result, &stack);
+			}
+		}
+
+		static void ResolveBases(void *payload) {
+			ResolveJob *job = static_cast<ResolveJob*>(payload);
+			IndexState *state = job->state;
+
+			for(size_t i = 0; i < job->bases.size(); i++) {
+				if(state->isFailed()) break;
+
+				uint32_t index = job->bases[i];
+				PackObject &object = state->objects[index];
+				object.realType = (git_otype)object.type;
+
+				ObjectData *data = new ObjectData;
+				data->index = index;
+				data->refs = 1;
+				if(!ReadObject(state, object, &data->bytes)) {
+					state->fail(GITERR_ZLIB, "Corrupted object in pack.");
+				}
+				else if(!Hash(object, data->bytes)) {
+					state->fail(GITERR_INDEXER, "Failed to hash object.");
+				}
+				else {
+					ReportResolved(state);
+					ResolveChildren(state, index, data);
+					continue;
+				}
+				Release(state, data);
+			}
+
+			delete job;
+		}
+
+		static void VerifyChecksum(void *payload) {
+			ChecksumJob *job = static_cast<ChecksumJob*>(payload);
+			IndexState *state = job->state;
+
+			Sha1 sha;
+			sha.update(state->data, state->size - GIT_OID_RAWSZ);
+			unsigned char digest[GIT_OID_RAWSZ];
+			sha.final(digest);
+			if(memcmp(digest, state->data + state->size - GIT_OID_RAWSZ,
+					GIT_OID_RAWSZ)) {
+				state->fail(GITERR_INDEXER, "Pack checksum mismatch.");
+			}
+
+			delete job;
+		}
+
+		static bool Fail(Baton *baton, int code, const string &message) {
+			baton->setError(code, message);
+			return false;
+		}
+
+		static uint32_t Get32(const unsigned char *p) {
+			return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+					(uint32_t)p[2] << 8 | p[3];
+		}
+
+		static void Put32(string *out, uint32_t value) {
+			char bytes[4] = {
+				(char)(value >> 24), (char)(value >> 16), (char)(value >> 8),
+				(char)value
+			};
+			out->append(bytes, 4);
+		}
+
+		/**
+			First pass: walk the object headers and inflate each object (to
+			nowhere) to find where the next one starts. Also links every
+			delta to its base.
+		*/
+		static bool Parse(IndexState *state, Baton *baton) {
+			const unsigned char *data = state->data;
+			size_t end = state->size - GIT_OID_RAWSZ;
+
+			if(state->size < 12 + GIT_OID_RAWSZ || memcmp(data, "PACK", 4)) {
+				return Fail(baton, GITERR_INDEXER, "Not a pack file.");
+			}
+			uint32_t version = Get32(data + 4);
+			if(version != 2 && version != 3) {
+				return Fail(baton, GITERR_INDEXER, "Unsupported pack version.");
+			}
+			uint32_t count = Get32(data + 8);
+
+			vector<PackObject> &objects = state->objects;
+			objects.resize(count);
+			vector<uint32_t> ofsCount(count + 1, 0);
+			vector<unsigned char> scratch(65536);
+
+			size_t pos = 12;
+			for(uint32_t i = 0; i < count; i++) {
+				if(baton->cancelPoint()) return false;
+				PackObject &object = objects[i];
+				object.offset = pos;
+				object.resolved = false;
+
+				if(pos >= end) return Fail(baton, GITERR_INDEXER, "Truncated pack.");
+				unsigned char c = data[pos++];
+				object.type = (c >> 4) & 7;
+				size_t size = c & 15;
+				int shift = 4;
+				while(c & 0x80) {
+					if(pos >= end || shift > 57) {
+						return Fail(baton, GITERR_INDEXER, "Bad object header.");
+					}
+					c = data[pos++];
+					size |= (size_t)(c & 0x7f) << shift;
+					shift += 7;
+				}
+				object.size = size;
+
+				if(object.type == OBJ_OFS_DELTA) {
+					if(pos >= end) return Fail(baton, GITERR_INDEXER, "Truncated pack.");
+					c = data[pos++];
+					uint64_t distance = c & 0x7f;
+					while(c & 0x80) {
+						if(pos >= end) return Fail(baton, GITERR_INDEXER, "Truncated pack.");
+						c = data[pos++];
+						distance = ((distance + 1) << 7) | (c & 0x7f);
+					}
+					if(distance == 0 || distance > object.offset) {
+						return Fail(baton, GITERR_INDEXER, "Bad delta base offset.");
+					}
+
+					// Objects are in offset order, so the base is found by
+					// binary search among the ones already parsed.
+					uint64_t baseOffset = object.offset - distance;
+					size_t lo = 0, hi = i;
+					while(lo < hi) {
+						size_t mid = (lo + hi) / 2;
+						if(objects[mid].offset < baseOffset) lo = mid + 1;
+						else hi = mid;
+					}
+					if(lo == i || objects[lo].offset != baseOffset) {
+						return Fail(baton, GITERR_INDEXER, "Bad delta base offset.");
+					}
+					object.base = lo;
+					ofsCount[lo]++;
+				}
+				else if(object.type == OBJ_REF_DELTA) {
+					if(pos + GIT_OID_RAWSZ > end) {
+						return Fail(baton, GITERR_INDEXER, "Truncated pack.");
+					}
+					git_oid_fromraw(&object.baseId, data + pos);
+					pos += GIT_OID_RAWSZ;
+					state->refChildren[object.baseId].push_back(i);
+				}
+				else if(object.type < OBJ_COMMIT || object.type > OBJ_TAG) {
+					return Fail(baton, GITERR_INDEXER, "Unknown object type.");
+				}
+
+				object.dataOffset = pos;
+				size_t used;
+				if(!Inflate(data + pos, end - pos, NULL, object.size, &scratch,
+						&used)) {
+					return Fail(baton, GITERR_ZLIB, "Corrupted object in pack.");
+				}
+				pos += used;
+				object.end = pos;
+				object.crc = crc32(0, data + object.offset,
+						(uInt)(object.end - object.offset));
+			}
+
+			if(pos != end) {
+				return Fail(baton, GITERR_INDEXER, "Trailing garbage in pack.");
+			}
+
+			// Flatten the OFS_DELTA children into one array.
+			state->ofsStart.resize(count + 1);
+			uint32_t total = 0;
+			for(uint32_t i = 0; i < count; i++) {
+				state->ofsStart[i] = total;
+				total += ofsCount[i];
+			}
+			state->ofsStart[count] = total;
+			state->ofsChildren.resize(total);
+			vector<uint32_t> fill(state->ofsStart.begin(), state->ofsStart.end() - 1);
+			for(uint32_t i = 0; i < count; i++) {
+				if(objects[i].type == OBJ_OFS_DELTA) {
+					state->ofsChildren[fill[objects[i].base]++] = i;
+				}
+			}
+			return true;
+		}
+
+		struct ObjectOrder {
+			const vector<PackObject> *objects;
+			bool operator()(uint32_t a, uint32_t b) const {
+				return git_oid_cmp(&(*objects)[a].oid, &(*objects)[b].oid) < 0;
+			}
+		};
+
+		// Version 2 .idx: fanout, sorted ids, crcs, offsets, pack checksum and
+		// its own checksum.
+		static string FormatIndex(IndexState *state, const vector<uint32_t> &order) {
+			const vector<PackObject> &objects = state->objects;
+			string out;
+			out.append("\377tOc", 4);
+			Put32(&out, 2);
+
+			uint32_t fanout[256];
+			memset(fanout, 0, sizeof(fanout));
+			for(size_t i = 0; i < order.size(); i++) {
+				fanout[objects[order[i]].oid.id[0]]++;
+			}
+			uint32_t running = 0;
+			for(int i = 0; i < 256; i++) {
+				running += fanout[i];
+				Put32(&out, running);
+			}
+
+			for(size_t i = 0; i < order.size(); i++) {
+				out.append((const char*)objects[order[i]].oid.id, GIT_OID_RAWSZ);
+			}
+			for(size_t i = 0; i < order.size(); i++) {
+				Put32(&out, objects[order[i]].crc);
+			}
+
+			vector<uint64_t> large;
+			for(size_t i = 0; i < order.size(); i++) {
+				uint64_t offset = objects[order[i]].offset;
+				if(offset < LARGE_OFFSET) {
+					Put32(&out, (uint32_t)offset);
+				}
+				else {
+					Put32(&out, LARGE_OFFSET | (uint32_t)large.size());
+					large.push_back(offset);
+				}
+			}
+			for(size_t i = 0; i < large.size(); i++) {
+				Put32(&out, (uint32_t)(large[i] >> 32));
+				Put32(&out, (uint32_t)large[i]);
+			}
+
+			out.append((const char*)state->data + state->size - GIT_OID_RAWSZ,
+					GIT_OID_RAWSZ);
+			Sha1 sha;
+			sha.update(out.data(), out.size());
+			unsigned char digest[GIT_OID_RAWSZ];
+			sha.final(digest);
+			out.append((const char*)digest, GIT_OID_RAWSZ);
+			return out;
+		}
+
+		// Writes data to path through a temporary file and a rename.
+		static bool WriteFile(const string &path, const char *data, size_t len) {
+			string tmpPath = path + ".tmp";
+			int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0444);
+			if(fd < 0) return false;
+
+			while(len > 0) {
+				ssize_t written = write(fd, data, len);
+				if(written < 0) {
+					if(errno == EINTR) continue;
+					close(fd);
+					unlink(tmpPath.c_str());
+					return false;
+				}
+				data += written;
+				len -= written;
+			}
+
+			if(fsync(fd) < 0 || close(fd) < 0 ||
+					rename(tmpPath.c_str(), path.c_str()) < 0) {
+				unlink(tmpPath.c_str());
+				return false;
+			}
+			return true;
+		}
+
+		static bool Resolve(IndexState *state, int threads, Baton *baton) {
+			vector<PackObject> &objects = state->objects;
+
+			CREATE_MUTEX(state->lock);
+			WorkQueue queue(threads);
+			state->queue = &queue;
+
+			ChecksumJob *checksum = new ChecksumJob;
+			checksum->state = state;
+			queue.push(VerifyChecksum, checksum);
+
+			ResolveJob *job = NULL;
+			for(uint32_t i = 0; i < objects.size(); i++) {
+				if(objects[i].type == OBJ_OFS_DELTA ||
+						objects[i].type == OBJ_REF_DELTA) {
+					continue;
+				}
+				if(job == NULL) {
+					job = new ResolveJob;
+					job->state = state;
+				}
+				job->bases.push_back(i);
+				if(job->bases.size() == CHUNK_SIZE) {
+					queue.push(ResolveBases, job);
+					job = NULL;
+				}
+			}
+			if(job) queue.push(ResolveBases, job);
+
+			queue.run();
+			DESTROY_MUTEX(state->lock);
+
+			if(state->failed) {
+				return Fail(baton, state->errorCode, state->errorMessage);
+			}
+			for(size_t i = 0; i < objects.size(); i++) {
+				if(!objects[i].resolved) {
+					return Fail(baton, GITERR_INDEXER,
+							"Pack has deltas against objects it doesn't contain.");
+				}
+			}
+			return true;
+		}
+
+		static bool IndexMapped(IndexState *state, const string &packPath,
+				const string &packDir, int threads, Result *result,
+				Baton *baton) {
+			if(!Parse(state, baton)) return false;
+
+			if(state->progress) {
+				state->progress->set(PROGRESS_TOTAL, state->objects.size());
+				state->progress->notify();
+			}
+
+			if(baton->cancelPoint() || !Resolve(state, threads, baton)) {
+				return false;
+			}
+
+			vector<uint32_t> order(state->objects.size());
+			for(uint32_t i = 0; i < order.size(); i++) order[i] = i;
+			ObjectOrder less = { &state->objects };
+			std::sort(order.begin(), order.end(), less);
+			for(size_t i = 1; i < order.size(); i++) {
+				if(!less(order[i - 1], order[i])) {
+					return Fail(baton, GITERR_INDEXER, "Duplicate object in pack.");
+				}
+			}
+
+			result->objects = state->objects.size();
+			result->deltas = 0;
+			for(size_t i = 0; i < state->objects.size(); i++) {
+				int type = state->objects[i].type;
+				if(type == OBJ_OFS_DELTA || type == OBJ_REF_DELTA) {
+					result->deltas++;
+				}
+			}
+			git_oid_fromraw(&result->packId,
+					state->data + state->size - GIT_OID_RAWSZ);
+
+			char hex[GIT_OID_HEXSZ + 1];
+			hex[GIT_OID_HEXSZ] = 0;
+			git_oid_fmt(hex, &result->packId);
+			string base = packDir;
+			if(!base.empty() && base[base.size() - 1] != '/') base += "/";
+			base += string("pack-") + hex;
+
+			// The pack goes in first, a pack only becomes visible to readers
+			// once its .idx is there.
+			if(packPath != base + ".pack" && !WriteFile(base + ".pack",
+					(const char*)state->data, state->size)) {
+				return Fail(baton, GITERR_OS, "Failed to write '" + base + ".pack'.");
+			}
+			string index = FormatIndex(state, order);
+			if(!WriteFile(base + ".idx", index.data(), index.size())) {
+				return Fail(baton, GITERR_OS, "Failed to write '" + base + ".idx'.");
+			}
+			return true;
+		}
+
+		bool Run(const string &packPath, const string &packDir, int threads,
+				Progress *progress, Result *result, Baton *baton) {
+			return Run(packPath, 0, packDir, threads, progress, result, baton);
+		}
+
+		bool Run(const string &packPath, off_t offset, const string &packDir,
+				int threads, Progress *progress, Result *result, Baton *baton) {
+			int fd = open(packPath.c_str(), O_RDONLY);
+			if(fd < 0) {
+				return Fail(baton, GITERR_OS, "Failed to open '" + packPath + "'.");
+			}
+			struct stat st;
+			if(fstat(fd, &st) < 0 || st.st_size <= offset) {
+				close(fd);
+				return Fail(baton, GITERR_INDEXER, "Not a pack file.");
+			}
+
+			void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			close(fd);
+			if(map == MAP_FAILED) {
+				return Fail(baton, GITERR_OS, "Failed to map '" + packPath + "'.");
+			}
+
+			IndexState state;
+			state.data = static_cast<const unsigned char*>(map) + offset;
+			state.size = st.st_size - offset;
+			state.progress = progress;
+			state.failed = false;
+			state.errorCode = 0;
+
+			bool ok = IndexMapped(&state, packPath, packDir, threads, result, baton);
+			munmap(map, st.st_size);
+			return ok;
+		}
+	};
+}; // namespace gitteh
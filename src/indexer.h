@@ -0,0 +1,42 @@
+#ifndef GITTEH_INDEXER_H
+#define GITTEH_INDEXER_H
+
+#include "gitteh.h"
+
+namespace gitteh {
+	class Progress;
+
+	namespace Indexer {
+		// Fields reported through Progress, in callback argument order.
+		enum {
+			PROGRESS_DONE,
+			PROGRESS_TOTAL,
+			PROGRESS_FIELDS
+		};
+
+		struct Result {
+			unsigned int objects;
+			unsigned int deltas;
+			git_oid packId;
+		};
+
+		/**
+			Indexes the pack at packPath and installs it into packDir as
+			pack-<checksum>.pack / .idx (the .idx written last, so readers never
+			see a pack without one). Object boundaries are found in one
+			sequential pass, then every non-delta object is hashed and the
+			deltas built on it resolved, base first, on `threads` native
+			threads. Thin packs (deltas against objects outside the pack) are
+			rejected. Needs no repository lock.
+		*/
+		bool Run(const string &packPath, const string &packDir, int threads,
+				Progress*, Result*, Baton*);
+
+		// Same, for a pack that starts offset bytes into the file (as in a
+		// bundle). Only the pack itself is installed.
+		bool Run(const string &packPath, off_t offset, const string &packDir,
+				int threads, Progress*, Result*, Baton*);
+	};
+}; // namespace gitteh
+
+#endif // GITTEH_INDEXER_H
@@ -0,0 +1,474 @@
+#include "iterator.h"
+#include "repository.h"
+#include "scheduler.h"
+#include <algorithm>
+
+using std::vector;
+
+namespace gitteh {
+	static Persistent<String> class_symbol;
+	static Persistent<String> entry_path_symbol;
+	static Persistent<String> entry_name_symbol;
+	static Persistent<String> entry_id_symbol;
+	static Persistent<String> entry_type_symbol;
+	static Persistent<String> entry_attributes_symbol;
+
+	// Most items a single fill produces. Small enough that a reader waiting
+	// on an empty ring isn't kept waiting long, big enough to be worth the
+	// trip to a worker.
+	static const size_t MAX_CHUNK = 64;
+
+	class FillBaton : public Baton {
+	public:
+		Iterator *iterator;
+		size_t max;
+		vector<Iterator::Item> items;
+		bool more;
+
+		FillBaton(Iterator *iterator, size_t max) : Baton(),
+				iterator(iterator), max(max), more(true) {
+			iterator->Ref();
+		}
+
+		~FillBaton() {
+			// Commits that never made it into the ring.
+			for(size_t i = 0; i < items.size(); i++) {
+				if(items[i].object) git_object_free(items[i].object);
+			}
+			iterator->Unref();
+		}
+	};
+
+	/**
+		Revision walk, newest first unless sorted otherwise. With any
+		sorting libgit2 walks everything before returning the first commit,
+		so that one fill takes a while.
+	*/
+	class CommitSource : public Iterator::Source {
+	public:
+		CommitSource(const vector<git_oid> &from, const vector<git_oid> &hide,
+				unsigned int sorting) : from_(from), hide_(hide),
+				sorting_(sorting), walk_(NULL) { }
+
+		~CommitSource() {
+			if(walk_) git_revwalk_free(walk_);
+		}
+
+		bool produce(Repository *repo, size_t max,
+				vector<Iterator::Item> *items, Baton *baton) {
+			repo->lockObjects();
+			bool more = walk_ != NULL || start(repo, baton);
+			while(more && items->size() < max) {
+				git_oid oid;
+				int result = git_revwalk_next(&oid, walk_);
+				if(result == GIT_REVWALKOVER) {
+					giterr_clear();
+					more = false;
+					break;
+				}
+
+				Iterator::Item item;
+				item.object = NULL;
+				if(!AsyncLibCall(result, baton) ||
+						!AsyncLibCall(git_object_lookup(&item.object, repo->repo_,
+						&oid, GIT_OBJ_COMMIT), baton)) {
+					more = false;
+					break;
+				}
+				items->push_back(item);
+			}
+			repo->unlockObjects();
+			return more;
+		}
+
+		Handle<Value> convert(Iterator::Item *item) {
+			HandleScope scope;
+			Handle<Object> commit = Repository::CreateObject(item->object);
+			git_object_free(item->object);
+			item->object = NULL;
+			return scope.Close(commit);
+		}
+
+	private:
+		bool start(Repository *repo, Baton *baton) {
+			if(!AsyncLibCall(git_revwalk_new(&walk_, repo->repo_), baton)) {
+				walk_ = NULL;
+				return false;
+			}
+			git_revwalk_sorting(walk_, sorting_);
+			for(size_t i = 0; i < from_.size(); i++) {
+				if(!AsyncLibCall(git_revwalk_push(walk_, &from_[i]), baton)) {
+					return false;
+				}
+			}
+			for(size_t i = 0; i < hide_.size(); i++) {
+				if(!AsyncLibCall(git_revwalk_hide(walk_, &hide_[i]), baton)) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		vector<git_oid> from_;
+		vector<git_oid> hide_;
+		unsigned int sorting_;
+		git_revwalk *walk_;
+	};
+
+	/**
+		Refs in name order, listed a chunk at a time by Refs::List, each
+		chunk picking up after the last name of the one before.
+	*/
+	class RefSource : public Iterator::Source {
+	public:
+		RefSource(const Refs::ListOptions &options) : options_(options) { }
+
+		bool produce(Repository *repo, size_t max,
+				vector<Iterator::Item> *items, Baton *baton) {
+			vector<Refs::ListedRef> refs;
+			bool more;
+			options_.limit = max;
+			if(!Refs::List(repo, options_, &refs, &more, baton)) return false;
+
+			for(size_t i = 0; i < refs.size(); i++) {
+				Iterator::Item item;
+				item.object = NULL;
+				item.ref = refs[i];
+				items->push_back(item);
+			}
+			if(!refs.empty()) options_.after = refs.back().name;
+			return more;
+		}
+
+		Handle<Value> convert(Iterator::Item *item) {
+			return Repository::CreateListedReference(item->ref);
+		}
+
+	private:
+		Refs::ListOptions options_;
+	};
+
+	/**
+		Every entry under a tree, depth first in tree order, with its path
+		from the root. Subtrees are only listed themselves if asked for.
+	*/
+	class TreeSource : public Iterator::Source {
+	public:
+		TreeSource(const git_oid &treeId, bool trees) : treeId_(treeId),
+				trees_(trees), started_(false) { }
+
+		~TreeSource() {
+			for(size_t i = 0; i < stack_.size(); i++) {
+				git_tree_free(stack_[i].tree);
+			}
+		}
+
+		bool produce(Repository *repo, size_t max,
+				vector<Iterator::Item> *items, Baton *baton) {
+			repo->lockObjects();
+			bool ok = true;
+			if(!started_) {
+				started_ = true;
+				ok = push(repo, &treeId_, "", baton);
+			}
+
+			while(ok && !stack_.empty() && items->size() < max) {
+				Frame &frame = stack_.back();
+				if(frame.index >= git_tree_entrycount(frame.tree)) {
+					git_tree_free(frame.tree);
+					stack_.pop_back();
+					continue;
+				}
+
+				const git_tree_entry *entry = git_tree_entry_byindex(frame.tree,
+						frame.index++);
+				Iterator::Item item;
+				item.object = NULL;
+				item.path = frame.prefix + git_tree_entry_name(entry);
+				item.oid = *git_tree_entry_id(entry);
+				item.type = git_tree_entry_type(entry);
+				item.attributes = git_tree_entry_attributes(entry);
+
+				// frame is gone once something is pushed.
+				if(item.type == GIT_OBJ_TREE) {
+					ok = push(repo, &item.oid, item.path + "/", baton);
+					if(!trees_) continue;
+				}
+				if(ok) items->push_back(item);
+			}
+			repo->unlockObjects();
+			return ok && !stack_.empty();
+		}
+
+		Handle<Value> convert(Iterator::Item *item) {
+			HandleScope scope;
+			Handle<Object> entry = Object::New();
+			size_t slash = item->path.rfind('/');
+			entry->Set(entry_path_symbol, CastToJS(item->path));
+			entry->Set(entry_name_symbol, CastToJS(slash == string::npos ?
+					item->path : item->path.substr(slash + 1)));
+			entry->Set(entry_id_symbol, CastToJS(item->oid));
+			entry->Set(entry_type_symbol, CastToJS(item->type));
+			entry->Set(entry_attributes_symbol, CastToJS(item->attributes));
+			return scope.Close(entry);
+		}
+
+	private:
+		struct Frame {
+			git_tree *tree;
+			unsigned int index;
+			string prefix;
+		};
+
+		bool push(Repository *repo, const git_oid *oid, const string &prefix,
+				Baton *baton) {
+			Frame frame;
+			if(!AsyncLibCall(git_tree_lookup(&frame.tree, repo->repo_, oid),
+					baton)) {
+				return false;
+			}
+			frame.index = 0;
+			frame.prefix = prefix;
+			stack_.push_back(frame);
+			return true;
+		}
+
+		git_oid treeId_;
+		bool trees_;
+		bool started_;
+		vector<Frame> stack_;
+	};
+
+	Persistent<FunctionTemplate> Iterator::constructor_template;
+
+	Iterator::Iterator(Repository *repo, Source *source, size_t readAhead) :
+			ObjectWrap(), repo_(repo), source_(source) {
+		ring_.resize(readAhead);
+		for(size_t i = 0; i < ring_.size(); i++) {
+			ring_[i].object = NULL;
+		}
+		head_ = 0;
+		count_ = 0;
+		chunk_ = readAhead < MAX_CHUNK ? readAhead : MAX_CHUNK;
+		filling_ = false;
+		done_ = false;
+		closed_ = false;
+		repo_->Ref();
+	}
+
+	Iterator::~Iterator() {
+		for(size_t i = 0; i < ring_.size(); i++) {
+			if(ring_[i].object) git_object_free(ring_[i].object);
+		}
+		delete source_;
+		waiting_.Dispose();
+		waiting_.Clear();
+		error_.Dispose();
+		error_.Clear();
+		repo_->Unref();
+	}
+
+	void Iterator::Init(Handle<Object> target) {
+		HandleScope scope;
+
+		class_symbol = NODE_PSYMBOL("NativeIterator");
+		entry_path_symbol = NODE_PSYMBOL("path");
+		entry_name_symbol = NODE_PSYMBOL("name");
+		entry_id_symbol = NODE_PSYMBOL("id");
+		entry_type_symbol = NODE_PSYMBOL("type");
+		entry_attributes_symbol = NODE_PSYMBOL("attributes");
+
+		Local<FunctionTemplate> t = FunctionTemplate::New(New);
+		constructor_template = Persistent<FunctionTemplate>::New(t);
+		constructor_template->SetClassName(class_symbol);
+		t->InstanceTemplate()->SetInternalFieldCount(1);
+
+		NODE_SET_PROTOTYPE_METHOD(t, "read", Read);
+		NODE_SET_PROTOTYPE_METHOD(t, "close", Close);
+
+		target->Set(class_symbol, constructor_template->GetFunction());
+	}
+
+	/**
+		(repo, kind, readAhead, ...) where the rest depends on kind:
+		"commits": from oids, hidden oids, topological, time, reverse.
+		"refs": prefix, glob, resolve, peelTags.
+		"tree": tree id, whether to list subtrees too.
+	*/
+	Handle<Value> Iterator::New(const Arguments &args) {
+		HandleScope scope;
+
+		if(args.Length() < 3 ||
+				!Repository::constructor_template->HasInstance(args[0])) {
+			return ThrowException(Exception::TypeError(
+					String::New("Expected a repository.")));
+		}
+		Repository *repo = ObjectWrap::Unwrap<Repository>(args[0]->ToObject());
+		string kind = CastFromJS<string>(args[1]);
+		size_t readAhead = CastFromJS<unsigned int>(args[2]);
+		if(readAhead < 1) readAhead = 1;
+
+		Source *source;
+		if(kind == "commits") {
+			unsigned int sorting = GIT_SORT_NONE;
+			if(CastFromJS<bool>(args[5])) sorting |= GIT_SORT_TOPOLOGICAL;
+			if(CastFromJS<bool>(args[6])) sorting |= GIT_SORT_TIME;
+			if(CastFromJS<bool>(args[7])) sorting |= GIT_SORT_REVERSE;
+			source = new CommitSource(CastFromJS<vector<git_oid> >(args[3]),
+					CastFromJS<vector<git_oid> >(args[4]), sorting);
+		}
+		else if(kind == "refs") {
+			Refs::ListOptions options;
+			options.prefix = CastFromJS<string>(args[3]);
+			options.glob = CastFromJS<string>(args[4]);
+			options.resolve = CastFromJS<bool>(args[5]);
+			options.peelTags = CastFromJS<bool>(args[6]);
+			options.limit = 0;
+			source = new RefSource(options);
+		}
+		else if(kind == "tree") {
+			source = new TreeSource(CastFromJS<git_oid>(args[3]),
+					CastFromJS<bool>(args[4]));
+		}
+		else {
+			return ThrowException(Exception::TypeError(
+					String::New("Unknown kind of iterator.")));
+		}
+
+		Iterator *iterator = new Iterator(repo, source, readAhead);
+		iterator->Wrap(args.This());
+		iterator->fill();
+
+		return args.This();
+	}
+
+	Handle<Value> Iterator::Read(const Arguments &args) {
+		HandleScope scope;
+		Iterator *iterator = ObjectWrap::Unwrap<Iterator>(args.This());
+
+		if(iterator->count_ > 0) {
+			Handle<Value> items = iterator->drain();
+			iterator->fill();
+			return scope.Close(items);
+		}
+		if(!iterator->error_.IsEmpty()) {
+			return scope.Close(iterator->error_);
+		}
+		if(iterator->done_ || iterator->closed_) {
+			return Null();
+		}
+		if(!iterator->waiting_.IsEmpty()) {
+			return ThrowException(Exception::Error(
+					String::New("A read is already waiting.")));
+		}
+
+		iterator->waiting_ = Persistent<Function>::New(
+				Handle<Function>::Cast(args[0]));
+		iterator->fill();
+		return Undefined();
+	}
+
+	Handle<Value> Iterator::Close(const Arguments &args) {
+		HandleScope scope;
+		ObjectWrap::Unwrap<Iterator>(args.This())->close();
+		return Undefined();
+	}
+
+	void Iterator::close() {
+		if(closed_) return;
+		closed_ = true;
+		for(; count_ > 0; count_--) {
+			Item &item = ring_[head_];
+			if(item.object) git_object_free(item.object);
+			item.object = NULL;
+			head_ = (head_ + 1) % ring_.size();
+		}
+		// A read that's waiting is answered (with no more items) when the
+		// fill it's waiting on comes back.
+	}
+
+	/**
+		Queues the next chunk, unless one is on its way already or there's
+		no room for it. Fills belong to the iterator, not to whatever call
+		happened to trigger them, so they don't inherit a timeout.
+	*/
+	void Iterator::fill() {
+		if(filling_ || done_ || closed_ || !error_.IsEmpty()) return;
+		if(ring_.size() - count_ < chunk_) return;
+		filling_ = true;
+
+		FillBaton *baton = new FillBaton(this, chunk_);
+		baton->deadline = 0;
+		Scheduler::Queue(baton, AsyncFill, AsyncAfterFill);
+	}
+
+	Handle<Value> Iterator::drain() {
+		HandleScope scope;
+		Handle<Array> items = Array::New(count_);
+		for(size_t i = 0; count_ > 0; i++, count_--) {
+			items->Set(i, source_->convert(&ring_[head_]));
+			head_ = (head_ + 1) % ring_.size();
+		}
+		return scope.Close(items);
+	}
+
+	void Iterator::AsyncFill(uv_work_t *req) {
+		FillBaton *baton = GetBaton<FillBaton>(req);
+		Iterator *iterator = baton->iterator;
+		baton->more = iterator->source_->produce(iterator->repo_, baton->max,
+				&baton->items, baton);
+	}
+
+	void Iterator::AsyncAfterFill(uv_work_t *req) {
+		HandleScope scope;
+		FillBaton *baton = GetBaton<FillBaton>(req);
+		Iterator *iterator = baton->iterator;
+		iterator->filling_ = false;
+
+		if(!iterator->closed_) {
+			// Swapped rather than copied, the slots keep their buffers.
+			vector<Item> &items = baton->items;
+			for(size_t i = 0; i < items.size(); i++) {
+				size_t slot = (iterator->head_ + iterator->count_) %
+						iterator->ring_.size();
+				std::swap(iterator->ring_[slot], items[i]);
+				iterator->count_++;
+			}
+			items.clear();
+
+			if(baton->isErrored()) {
+				iterator->error_ = Persistent<Value>::New(baton->createV8Error());
+			}
+			else if(!baton->more) {
+				iterator->done_ = true;
+			}
+		}
+
+		if(!iterator->waiting_.IsEmpty() &&
+				(iterator->count_ > 0 || iterator->done_ || iterator->closed_ ||
+				!iterator->error_.IsEmpty())) {
+			Persistent<Function> callback = iterator->waiting_;
+			iterator->waiting_.Clear();
+
+			if(iterator->count_ > 0) {
+				Handle<Value> argv[] = { Null(), iterator->drain() };
+				iterator->fill();
+				FireCallback(callback, 2, argv);
+			}
+			else if(iterator->done_ || iterator->closed_) {
+				Handle<Value> argv[] = { Null(), Null() };
+				FireCallback(callback, 2, argv);
+			}
+			else {
+				Handle<Value> argv[] = { iterator->error_ };
+				FireCallback(callback, 1, argv);
+			}
+			callback.Dispose();
+		}
+		else {
+			iterator->fill();
+		}
+
+		delete baton;
+	}
+}; // namespace gitteh
@@ -0,0 +1,90 @@
+#ifndef GITTEH_ITERATOR_H
+#define GITTEH_ITERATOR_H
+
+#include "gitteh.h"
+#include "refs.h"
+#include <vector>
+
+namespace gitteh {
+	class Repository;
+	class FillBaton;
+
+	/**
+		Hands out the items of a long listing (a revision walk, a ref
+		listing, a flattened tree) as JS asks for them, rather than all at
+		once or one round trip each. A Source produces the items on the
+		Scheduler's workers, a chunk per request, into a ring of `readAhead`
+		slots. Whenever there's room for another chunk and the Source isn't
+		done, the next one is queued, so production runs ahead of JS reading
+		the ring.
+
+		read() returns whatever is in the ring (converted to JS) straight
+		away, null once the Source is done, or the Error it failed with. If
+		the ring is empty it returns undefined, and the callback gets
+		(err, items) or (null, null) when the next chunk lands. Only one
+		read can wait at a time, a second one throws.
+	*/
+	class Iterator : public ObjectWrap {
+	public:
+		friend class FillBaton;
+
+		static Persistent<FunctionTemplate> constructor_template;
+		static void Init(Handle<Object>);
+
+		// A ring slot. Each Source uses the fields it needs, the strings
+		// keep their buffers as slots are reused.
+		struct Item {
+			// Commits, converted and freed on the main thread.
+			git_object *object;
+			Refs::ListedRef ref;
+			// Tree entries.
+			string path;
+			git_oid oid;
+			git_otype type;
+			unsigned int attributes;
+		};
+
+		class Source {
+		public:
+			virtual ~Source() { }
+			// Worker thread, only ever one call at a time. Appends up to max
+			// items, returns false once there are no more (or on error, with
+			// the baton errored out).
+			virtual bool produce(Repository*, size_t max, std::vector<Item>*,
+					Baton*) = 0;
+			// Main thread.
+			virtual Handle<Value> convert(Item*) = 0;
+		};
+
+	protected:
+		static Handle<Value> New(const Arguments&);
+		static Handle<Value> Read(const Arguments&);
+		static Handle<Value> Close(const Arguments&);
+
+	private:
+		Iterator(Repository*, Source*, size_t readAhead);
+		~Iterator();
+
+		void fill();
+		void close();
+		Handle<Value> drain();
+
+		static void AsyncFill(uv_work_t*);
+		static void AsyncAfterFill(uv_work_t*);
+
+		Repository *repo_;
+		Source *source_;
+		// Ring of capacity slots, count of them filled starting at head.
+		std::vector<Item> ring_;
+		size_t head_;
+		size_t count_;
+		size_t chunk_;
+		Persistent<Function> waiting_;
+		Persistent<Value> error_;
+		bool filling_;
+		bool done_;
+		bool closed_;
+	};
+}; // namespace gitteh
+
+#endif // GITTEH_ITERATOR_H
@@ -0,0 +1,71 @@
+#include "objectcache.h"
+
+namespace gitteh {
+	ObjectCache::ObjectCache() {
+		CREATE_MUTEX(lock_);
+	}
+
+	ObjectCache::~ObjectCache() {
+		clear();
+		DESTROY_MUTEX(lock_);
+	}
+
+	void ObjectCache::lock() {
+		LOCK_MUTEX(lock_);
+	}
+
+	bool ObjectCache::tryLock() {
+		return TRYLOCK_MUTEX(lock_) == 0;
+	}
+
+	void ObjectCache::unlock() {
+		UNLOCK_MUTEX(lock_);
+	}
+
+	void ObjectCache::add(git_repository *repo, git_object *object) {
+		const git_oid *id = git_object_id(object);
+		git_otype type = git_object_type(object);
+		if(type == GIT_OBJ_BLOB &&
+				(size_t)git_blob_rawsize((git_blob*)object) > MAX_BLOB_SIZE) {
+			return;
+		}
+		if(type == GIT_OBJ_TREE &&
+				git_tree_entrycount((git_tree*)object) > MAX_TREE_ENTRIES) {
+			return;
+		}
+		if(lookup(*id) != NULL) return;
+
+		// The caller's object is still alive, so this comes straight out of
+		// libgit2's own cache with its refcount bumped.
+		git_object *ours;
+		if(git_object_lookup(&ours, repo, id, type) != GIT_OK) {
+			giterr_clear();
+			return;
+		}
+
+		objects_.push_front(ours);
+		index_[*id] = objects_.begin();
+
+		if(objects_.size() > MAX_OBJECTS) {
+			git_object *oldest = objects_.back();
+			index_.erase(*git_object_id(oldest));
+			objects_.pop_back();
+			git_object_free(oldest);
+		}
+	}
+
+	git_object *ObjectCache::lookup(const git_oid &id) {
+		ObjectMap::iterator it = index_.find(id);
+		if(it == index_.end()) return NULL;
+		objects_.splice(objects_.begin(), objects_, it->second);
+		return *it->second;
+	}
+
+	void ObjectCache::clear() {
+		for(ObjectList::iterator it = objects_.begin(); it != objects_.end(); ++it) {
+			git_object_free(*it);
+		}
+		objects_.clear();
+		index_.clear();
+	}
+}; // namespace gitteh
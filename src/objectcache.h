@@ -0,0 +1,58 @@
+#ifndef GITTEH_OBJECTCACHE_H
+#define GITTEH_OBJECTCACHE_H
+
+#include "gitteh.h"
+#include <list>
+#include <map>
+
+namespace gitteh {
+	/**
+		The last few hundred small objects handed out by a repository, kept
+		parsed so they can be answered on the main thread without going to
+		the object database (see Repository::GetObjectSync). Blobs over
+		MAX_BLOB_SIZE and trees over MAX_TREE_ENTRIES aren't kept, copying
+		those into JS isn't much cheaper than a trip to a worker.
+
+		Holds a reference to each object, dropped when it's evicted. Callers
+		hold lock() around everything else, the main thread only ever
+		tryLock()s.
+	*/
+	class ObjectCache {
+	public:
+		static const size_t MAX_OBJECTS = 1024;
+		static const size_t MAX_BLOB_SIZE = 16 * 1024;
+		static const unsigned int MAX_TREE_ENTRIES = 256;
+
+		ObjectCache();
+		~ObjectCache();
+
+		void lock();
+		// False straight away if another thread holds the lock.
+		bool tryLock();
+		void unlock();
+
+		// Keeps a reference to object, if it's small enough to be worth it.
+		void add(git_repository*, git_object*);
+		// Borrowed, NULL if id isn't cached. Counts as a use.
+		git_object *lookup(const git_oid&);
+		// Drops everything, say once the object database has been swapped.
+		void clear();
+
+	private:
+		struct OidLess {
+			bool operator()(const git_oid &a, const git_oid &b) const {
+				return git_oid_cmp(&a, &b) < 0;
+			}
+		};
+
+		typedef std::list<git_object*> ObjectList;
+		typedef std::map<git_oid, ObjectList::iterator, OidLess> ObjectMap;
+
+		// Most recently used first.
+		ObjectList objects_;
+		ObjectMap index_;
+		gitteh_lock lock_;
+	};
+}; // namespace gitteh
+
+#endif // GITTEH_OBJECTCACHE_H
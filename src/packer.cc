@@ -0,0 +1,805 @@
+#include "packer.h"
+#include "repository.h"
+#include "workqueue.h"
+#include "progress.h"
+#include "sha1.h"
+#include <algorithm>
+#include <set>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <zlib.h>
+
+using std::set;
+using std::vector;
+
+namespace gitteh {
+	namespace Packer {
+		enum {
+			OBJ_COMMIT = 1,
+			OBJ_TREE = 2,
+			OBJ_BLOB = 3,
+			OBJ_TAG = 4,
+			OBJ_OFS_DELTA = 6,
+			OBJ_REF_DELTA = 7
+		};
+
+		// Objects per job, and jobs per round. A round's output is held in
+		// memory until it's been handed to the sink in order.
+		static const size_t CHUNK_OBJECTS = 256;
+		static const int CHUNKS_PER_THREAD = 4;
+
+		static const uint32_t LARGE_OFFSET = 0x80000000;
+		static const size_t IDX_HEADER_SIZE = 8 + 256 * 4;
+
+		struct OidLess {
+			bool operator()(const git_oid &a, const git_oid &b) const {
+				return git_oid_cmp(&a, &b) < 0;
+			}
+		};
+
+		typedef set<git_oid, OidLess> OidSet;
+
+		static bool Fail(Baton *baton, int code, const string &message) {
+			baton->setError(code, message);
+			return false;
+		}
+
+		static string FormatOid(const git_oid &oid) {
+			char hex[GIT_OID_HEXSZ + 1];
+			hex[GIT_OID_HEXSZ] = 0;
+			git_oid_fmt(hex, &oid);
+			return hex;
+		}
+
+		static uint32_t Get32(const unsigned char *p) {
+			return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+					(uint32_t)p[2] << 8 | p[3];
+		}
+
+		static void PutHeader(string *out, int type, uint64_t size) {
+			unsigned char c = (type << 4) | (size & 15);
+			size >>= 4;
+			while(size) {
+				out->push_back(c | 0x80);
+				c = size & 0x7f;
+				size >>= 7;
+			}
+			out->push_back(c);
+		}
+
+		/**
+			The repository's packs, as mmapped .idx (version 2) and .pack
+			pairs. Read only once opened, so jobs share it without locking.
+			libgit2 has no API for getting at an object's raw packed bytes,
+			so we read the files ourselves.
+		*/
+		class PackSet {
+		public:
+			struct Pack {
+				const unsigned char *idx;
+				size_t idxSize;
+				const unsigned char *data;
+				size_t size;
+				uint32_t count;
+				const unsigned char *oids;
+				const unsigned char *crcs;
+				const unsigned char *offsets;
+				const unsigned char *largeOffsets;
+				size_t largeCount;
+				// Entry positions, ordered by where they are in the pack.
+				vector<uint32_t> byOffset;
+			};
+
+			~PackSet() {
+				for(size_t i = 0; i < packs_.size(); i++) {
+					munmap((void*)packs_[i]->idx, packs_[i]->idxSize);
+					munmap((void*)packs_[i]->data, packs_[i]->size);
+					delete packs_[i];
+				}
+			}
+
+			// Packs that can't be read are skipped, their objects are then
+			// read through libgit2 instead.
+			void open(const string &packDir) {
+				DIR *dir = opendir(packDir.c_str());
+				if(dir == NULL) return;
+				struct dirent *entry;
+				while((entry = readdir(dir)) != NULL) {
+					string name = entry->d_name;
+					if(name.size() < 5 || name.compare(0, 5, "pack-") ||
+							name.compare(name.size() - 4, 4, ".idx")) {
+						continue;
+					}
+					string base = packDir + "/" + name.substr(0, name.size() - 4);
+					add(base + ".idx", base + ".pack");
+				}
+				closedir(dir);
+			}
+
+			bool find(const git_oid &oid, const Pack **pack,
+					uint32_t *pos) const {
+				for(size_t i = 0; i < packs_.size(); i++) {
+					const Pack *p = packs_[i];
+					unsigned char first = oid.id[0];
+					uint32_t lo = first ? Get32(p->idx + 8 + (first - 1) * 4) : 0;
+					uint32_t hi = Get32(p->idx + 8 + first * 4);
+					while(lo < hi) {
+						uint32_t mid = lo + (hi - lo) / 2;
+						int cmp = memcmp(p->oids + (size_t)mid * GIT_OID_RAWSZ,
+								oid.id, GIT_OID_RAWSZ);
+						if(cmp == 0) {
+							*pack = p;
+							*pos = mid;
+							return true;
+						}
+						if(cmp < 0) lo = mid + 1;
+						else hi = mid;
+					}
+				}
+				return false;
+			}
+
+			static bool offset(const Pack &pack, uint32_t pos, uint64_t *out) {
+				uint32_t value = Get32(pack.offsets + (size_t)pos * 4);
+				if(!(value & LARGE_OFFSET)) {
+					*out = value;
+					return true;
+				}
+				value &= ~LARGE_OFFSET;
+				if(value >= pack.largeCount) return false;
+				const unsigned char *p = pack.largeOffsets + (size_t)value * 8;
+				*out = (uint64_t)Get32(p) << 32 | Get32(p + 4);
+				return true;
+			}
+
+			// Finds the entry at the given offset, and where the entry after
+			// it starts (the trailer, for the last one).
+			static bool entryAt(const Pack &pack, uint64_t at, uint32_t *pos,
+					uint64_t *end) {
+				size_t lo = 0, hi = pack.byOffset.size();
+				while(lo < hi) {
+					size_t mid = lo + (hi - lo) / 2;
+					uint64_t value;
+					if(!offset(pack, pack.byOffset[mid], &value)) return false;
+					if(value == at) {
+						*pos = pack.byOffset[mid];
+						if(mid + 1 == pack.byOffset.size()) {
+							*end = pack.size - GIT_OID_RAWSZ;
+							return true;
+						}
+						return offset(pack, pack.byOffset[mid + 1], end);
+					}
+					if(value < at) lo = mid + 1;
+					else hi = mid;
+				}
+				return false;
+			}
+
+		private:
+			struct OffsetLess {
+				const Pack *pack;
+				bool operator()(uint32_t a, uint32_t b) const {
+					uint64_t x = 0, y = 0;
+					offset(*pack, a, &x);
+					offset(*pack, b, &y);
+					return x < y;
+				}
+			};
+
+			static const unsigned char *Map(const string &path, size_t *size) {
+				int fd = ::open(path.c_str(), O_RDONLY);
+				if(fd < 0) return NULL;
+				struct stat st;
+				void *map = MAP_FAILED;
+				if(fstat(fd, &st) == 0 && st.st_size > 0) {
+					*size = st.st_size;
+					map = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+				}
+				close(fd);
+				return map == MAP_FAILED ? NULL :
+						static_cast<const unsigned char*>(map);
+			}
+
+			void add(const string &idxPath, const string &packPath) {
+				Pack *pack = new Pack;
+				pack->idx = Map(idxPath, &pack->idxSize);
+				pack->data = Map(packPath, &pack->size);
+				if(pack->idx && pack->data && parse(pack)) {
+					packs_.push_back(pack);
+					return;
+				}
+				if(pack->idx) munmap((void*)pack->idx, pack->idxSize);
+				if(pack->data) munmap((void*)pack->data, pack->size);
+				delete pack;
+			}
+
+			bool parse(Pack *pack) {
+				const unsigned char *idx = pack->idx;
+				if(pack->idxSize < IDX_HEADER_SIZE + 2 * GIT_OID_RAWSZ ||
+						memcmp(idx, "\377tOc", 4) || Get32(idx + 4) != 2) {
+					return false;
+				}
+				pack->count = Get32(idx + 8 + 255 * 4);
+				size_t tables = IDX_HEADER_SIZE +
+						(size_t)pack->count * (GIT_OID_RAWSZ + 8);
+				if(pack->idxSize < tables + 2 * GIT_OID_RAWSZ) return false;
+				pack->oids = idx + IDX_HEADER_SIZE;
+				pack->crcs = pack->oids + (size_t)pack->count * GIT_OID_RAWSZ;
+				pack->offsets = pack->crcs + (size_t)pack->count * 4;
+				pack->largeOffsets = pack->offsets + (size_t)pack->count * 4;
+				pack->largeCount = (pack->idxSize - tables - 2 * GIT_OID_RAWSZ) / 8;
+
+				// The pack has to be the one this index was made for.
+				if(pack->size < 12 + GIT_OID_RAWSZ ||
+						memcmp(pack->data, "PACK", 4) ||
+						Get32(pack->data + 8) != pack->count ||
+						memcmp(pack->data + pack->size - GIT_OID_RAWSZ,
+								idx + pack->idxSize - 2 * GIT_OID_RAWSZ,
+								GIT_OID_RAWSZ)) {
+					return false;
+				}
+
+				pack->byOffset.resize(pack->count);
+				for(uint32_t i = 0; i < pack->count; i++) {
+					uint64_t value;
+					if(!offset(*pack, i, &value) ||
+							value >= pack->size - GIT_OID_RAWSZ) {
+						return false;
+					}
+					pack->byOffset[i] = i;
+				}
+				OffsetLess less = { pack };
+				std::sort(pack->byOffset.begin(), pack->byOffset.end(), less);
+				return true;
+			}
+
+			vector<Pack*> packs_;
+		};
+
+		/**
+			Reads an object and appends the objects it links to. Tree entries
+			come with their type from the mode, so blobs never get read here.
+		*/
+		static bool ReadLinks(git_odb *odb, const git_oid &oid, git_otype *type,
+				vector<git_oid> *links, vector<bool> *linkIsTree, Baton *baton) {
+			git_odb_object *object;
+			if(git_odb_read(&object, odb, &oid) != GIT_OK) {
+				return Fail(baton, GITERR_ODB, "Object " + FormatOid(oid) +
+						" not found.");
+			}
+			*type = git_odb_object_type(object);
+			const char *data = static_cast<const char*>(git_odb_object_data(object));
+			const char *end = data + git_odb_object_size(object);
+			bool ok = true;
+			git_oid link;
+
+			if(*type == GIT_OBJ_TREE) {
+				while(data < end) {
+					const char *nul = static_cast<const char*>(
+							memchr(data, 0, end - data));
+					if(nul == NULL || end - nul - 1 < GIT_OID_RAWSZ) {
+						ok = false;
+						break;
+					}
+					// Gitlinks are commits in some other repository.
+					if(strncmp(data, "160000 ", 7)) {
+						git_oid_fromraw(&link,
+								reinterpret_cast<const unsigned char*>(nul + 1));
+						links->push_back(link);
+						linkIsTree->push_back(!strncmp(data, "40000 ", 6));
+					}
+					data = nul + 1 + GIT_OID_RAWSZ;
+				}
+			}
+			else if(*type == GIT_OBJ_COMMIT || *type == GIT_OBJ_TAG) {
+				while(ok && data < end && *data != '\n') {
+					const char *eol = static_cast<const char*>(
+							memchr(data, '\n', end - data));
+					if(eol == NULL) eol = end;
+					string line(data, eol - data);
+					size_t space = line.find(' ');
+					string key = line.substr(0, space);
+					bool isLink = *type == GIT_OBJ_TAG ? key == "object" :
+							key == "tree" || key == "parent";
+					if(isLink && space != string::npos) {
+						ok = git_oid_fromstrn(&link, line.c_str() + space + 1,
+								line.size() - space - 1) == GIT_OK;
+						links->push_back(link);
+						linkIsTree->push_back(key == "tree");
+					}
+					data = eol + 1;
+				}
+			}
+			git_odb_object_free(object);
+
+			if(!ok) {
+				return Fail(baton, GITERR_ODB, "Object " + FormatOid(oid) +
+						" is corrupted.");
+			}
+			return true;
+		}
+
+		// Marks everything under tree as seen, without adding anything.
+		static bool MarkTree(git_odb *odb, const git_oid &tree, OidSet *seen,
+				Baton *baton) {
+			vector<git_oid> stack(1, tree);
+			while(!stack.empty()) {
+				git_oid oid = stack.back();
+				stack.pop_back();
+				if(!seen->insert(oid).second) continue;
+
+				git_otype type;
+				vector<git_oid> links;
+				vector<bool> isTree;
+				if(!ReadLinks(odb, oid, &type, &links, &isTree, baton)) return false;
+				for(size_t i = 0; i < links.size(); i++) {
+					if(isTree[i]) stack.push_back(links[i]);
+					else seen->insert(links[i]);
+				}
+			}
+			return true;
+		}
+
+		static bool Enumerate(git_odb *odb, const Options &options,
+				vector<git_oid> *objects, Baton *baton) {
+			// Commits the other side already has. Haves we don't know are
+			// just ignored, they may well have things we don't.
+			OidSet uninteresting;
+			vector<git_oid> stack(options.haves);
+			while(!stack.empty()) {
+				git_oid oid = stack.back();
+				stack.pop_back();
+				if(uninteresting.count(oid) || !git_odb_exists(odb, &oid)) continue;
+
+				git_otype type;
+				vector<git_oid> links;
+				vector<bool> isTree;
+				if(!ReadLinks(odb, oid, &type, &links, &isTree, baton)) return false;
+				if(type == GIT_OBJ_TAG) {
+					stack.insert(stack.end(), links.begin(), links.end());
+				}
+				else if(type == GIT_OBJ_COMMIT) {
+					uninteresting.insert(oid);
+					for(size_t i = 0; i < links.size(); i++) {
+						if(!isTree[i]) stack.push_back(links[i]);
+					}
+				}
+			}
+
+			// Commits (and tags) to send, remembering the trees they need
+			// and the commits they stop at.
+			OidSet seen, reached;
+			vector<git_oid> trees;
+			vector<git_oid> boundary;
+			stack.assign(options.wants.rbegin(), options.wants.rend());
+			while(!stack.empty()) {
+				if(baton->cancelPoint()) return false;
+				git_oid oid = stack.back();
+				stack.pop_back();
+				if(uninteresting.count(oid)) {
+					if(reached.insert(oid).second) boundary.push_back(oid);
+					continue;
+				}
+				if(!seen.insert(oid).second) continue;
+
+				git_otype type;
+				vector<git_oid> links;
+				vector<bool> isTree;
+				if(!ReadLinks(odb, oid, &type, &links, &isTree, baton)) return false;
+				if(type == GIT_OBJ_TREE || type == GIT_OBJ_BLOB) {
+					seen.erase(oid);
+					trees.push_back(oid);
+					continue;
+				}
+
+				objects->push_back(oid);
+				for(size_t i = links.size(); i-- > 0;) {
+					if(isTree[i]) trees.push_back(links[i]);
+					else stack.push_back(links[i]);
+				}
+			}
+
+			if(options.boundary) *options.boundary = boundary;
+
+			// Whatever the haves have, the other side has too.
+			boundary.insert(boundary.end(), options.haves.begin(),
+					options.haves.end());
+			for(size_t i = 0; i < boundary.size(); i++) {
+				git_otype type;
+				vector<git_oid> links;
+				vector<bool> isTree;
+				if(!git_odb_exists(odb, &boundary[i])) continue;
+				if(!ReadLinks(odb, boundary[i], &type, &links, &isTree, baton)) {
+					return false;
+				}
+				if(type != GIT_OBJ_COMMIT) continue;
+				for(size_t j = 0; j < links.size(); j++) {
+					if(isTree[j] && !MarkTree(odb, links[j], &seen, baton)) {
+						return false;
+					}
+				}
+			}
+
+			// And finally the trees and blobs.
+			for(size_t i = 0; i < trees.size(); i++) {
+				if(baton->cancelPoint()) return false;
+				vector<git_oid> treeStack(1, trees[i]);
+				vector<bool> treeIsTree(1, true);
+				while(!treeStack.empty()) {
+					git_oid oid = treeStack.back();
+					bool isTree = treeIsTree.back();
+					treeStack.pop_back();
+					treeIsTree.pop_back();
+					if(!seen.insert(oid).second) continue;
+					objects->push_back(oid);
+					if(!isTree) continue;
+
+					git_otype type;
+					vector<git_oid> links;
+					vector<bool> linkIsTree;
+					if(!ReadLinks(odb, oid, &type, &links, &linkIsTree, baton)) {
+						return false;
+					}
+					treeStack.insert(treeStack.end(), links.rbegin(), links.rend());
+					treeIsTree.insert(treeIsTree.end(), linkIsTree.rbegin(),
+							linkIsTree.rend());
+				}
+			}
+			return true;
+		}
+
+		struct PackState {
+			// Objects are read from repo's odb under its object lock, or if
+			// there's no Repository from odb, under odbLock.
+			Repository *repo;
+			git_odb *odb;
+			gitteh_lock odbLock;
+			const PackSet *packs;
+			// Everything going into the pack, sorted.
+			vector<git_oid> sending;
+
+			gitteh_lock lock;
+			bool failed;
+			int errorCode;
+			string errorMessage;
+
+			void fail(int code, const string &message) {
+				LOCK_MUTEX(lock);
+				if(!failed) {
+					failed = true;
+					errorCode = code;
+					errorMessage = message;
+				}
+				UNLOCK_MUTEX(lock);
+			}
+
+			// The odb to read from until unlockOdb(). A Repository's can be
+			// swapped by reloadObjects() in between.
+			git_odb *lockOdb() {
+				if(repo) {
+					repo->lockObjects();
+					return repo->odb_;
+				}
+				LOCK_MUTEX(odbLock);
+				return odb;
+			}
+
+			void unlockOdb() {
+				if(repo) repo->unlockObjects();
+				else UNLOCK_MUTEX(odbLock);
+			}
+
+			bool isSending(const git_oid &oid) const {
+				return std::binary_search(sending.begin(), sending.end(), oid,
+						OidLess());
+			}
+		};
+
+		struct Chunk {
+			PackState *state;
+			const git_oid *objects;
+			size_t count;
+			string out;
+			unsigned int reused;
+			unsigned int deltas;
+		};
+
+		/**
+			Copies an entry out of an existing pack. Deltas are only kept if
+			their base is going too, and comes out of the same pack: packs
+			never have delta cycles, so that way we can't create one.
+		*/
+		static bool CopyEntry(const PackState *state, const PackSet::Pack &pack,
+				uint32_t pos, string *out, bool *isDelta) {
+			uint64_t start, end;
+			uint32_t self;
+			if(!PackSet::offset(pack, pos, &start) ||
+					!PackSet::entryAt(pack, start, &self, &end) || end <= start) {
+				return false;
+			}
+			const unsigned char *data = pack.data;
+			uLong crc = crc32(0, data + start, end - start);
+			if(crc != Get32(pack.crcs + (size_t)pos * 4)) return false;
+
+			uint64_t p = start;
+			unsigned char c = data[p++];
+			int type = (c >> 4) & 7;
+			uint64_t size = c & 15;
+			int shift = 4;
+			while(c & 0x80) {
+				if(p >= end || shift > 57) return false;
+				c = data[p++];
+				size |= (uint64_t)(c & 0x7f) << shift;
+				shift += 7;
+			}
+
+			if(type >= OBJ_COMMIT && type <= OBJ_TAG) {
+				out->append((const char*)data + start, end - start);
+				*isDelta = false;
+				return true;
+			}
+
+			git_oid base;
+			if(type == OBJ_OFS_DELTA) {
+				if(p >= end) return false;
+				c = data[p++];
+				uint64_t distance = c & 127;
+				while(c & 128) {
+					if(p >= end) return false;
+					c = data[p++];
+					distance = ((distance + 1) << 7) | (c & 127);
+				}
+				uint32_t basePos;
+				uint64_t baseEnd;
+				if(distance > start ||
+						!PackSet::entryAt(pack, start - distance, &basePos, &baseEnd)) {
+					return false;
+				}
+				git_oid_fromraw(&base, pack.oids + (size_t)basePos * GIT_OID_RAWSZ);
+			}
+			else if(type == OBJ_REF_DELTA) {
+				if(end - p < GIT_OID_RAWSZ) return false;
+				git_oid_fromraw(&base, data + p);
+				p += GIT_OID_RAWSZ;
+			}
+			else {
+				return false;
+			}
+
+			const PackSet::Pack *basePack;
+			uint32_t basePos;
+			if(!state->isSending(base) ||
+					!state->packs->find(base, &basePack, &basePos) ||
+					basePack != &pack) {
+				return false;
+			}
+
+			PutHeader(out, OBJ_REF_DELTA, size);
+			out->append((const char*)base.id, GIT_OID_RAWSZ);
+			out->append((const char*)data + p, end - p);
+			*isDelta = true;
+			return true;
+		}
+
+		static bool DeflateObject(PackState *state, const git_oid &oid,
+				z_stream *zs, string *out) {
+			git_odb_object *object;
+			int result = git_odb_read(&object, state->lockOdb(), &oid);
+			state->unlockOdb();
+			if(result != GIT_OK) {
+				state->fail(GITERR_ODB, "Object " + FormatOid(oid) + " not found.");
+				return false;
+			}
+
+			size_t size = git_odb_object_size(object);
+			PutHeader(out, git_odb_object_type(object), size);
+
+			bool ok = deflateReset(zs) == Z_OK;
+			zs->next_in = (Bytef*)git_odb_object_data(object);
+			zs->avail_in = size;
+			unsigned char buf[16384];
+			int status = Z_OK;
+			while(ok && status != Z_STREAM_END) {
+				zs->next_out = buf;
+				zs->avail_out = sizeof(buf);
+				status = deflate(zs, Z_FINISH);
+				ok = status == Z_OK || status == Z_STREAM_END;
+				out->append((const char*)buf, sizeof(buf) - zs->avail_out);
+			}
+			git_odb_object_free(object);
+
+			if(!ok) state->fail(GITERR_ZLIB, "Failed to compress object.");
+			return ok;
+		}
+
+		static void WriteChunk(void *payload) {
+			Chunk *chunk = static_cast<Chunk*>(payload);
+			PackState *state = chunk->state;
+
+			z_stream zs;
+			memset(&zs, 0, sizeof(zs));
+			if(deflateInit(&zs, Z_DEFAULT_COMPRESSION) != Z_OK) {
+				state->fail(GITERR_ZLIB, "Failed to initialize zlib.");
+				return;
+			}
+
+			for(size_t i = 0; i < chunk->count; i++) {
+				const git_oid &oid = chunk->objects[i];
+				const PackSet::Pack *pack;
+				uint32_t pos;
+				bool isDelta;
+				size_t mark = chunk->out.size();
+				if(state->packs->find(oid, &pack, &pos) &&
+						CopyEntry(state, *pack, pos, &chunk->out, &isDelta)) {
+					chunk->reused++;
+					if(isDelta) chunk->deltas++;
+					continue;
+				}
+				chunk->out.resize(mark);
+				if(!DeflateObject(state, oid, &zs, &chunk->out)) break;
+			}
+
+			deflateEnd(&zs);
+		}
+
+		/**
+			Hands data on to the sink, keeping the checksum that ends the
+			pack.
+		*/
+		class Output {
+		public:
+			Output(Sink *sink) : sink_(sink), bytes_(0) { }
+
+			bool write(const string &data) {
+				if(data.empty()) return true;
+				sha_.update(data.data(), data.size());
+				bytes_ += data.size();
+				return sink_->write(data.data(), data.size());
+			}
+
+			bool finish() {
+				unsigned char digest[GIT_OID_RAWSZ];
+				sha_.final(digest);
+				bytes_ += GIT_OID_RAWSZ;
+				return sink_->write((const char*)digest, GIT_OID_RAWSZ);
+			}
+
+			uint64_t bytes() const {
+				return bytes_;
+			}
+
+		private:
+			Sink *sink_;
+			Sha1 sha_;
+			uint64_t bytes_;
+		};
+
+		static bool WriteObjects(PackState *state, const vector<git_oid> &objects,
+				int threads, Output *output, Progress *progress, Result *result,
+				Baton *baton) {
+			if(threads < 1) threads = WorkQueue::DefaultThreads();
+			size_t perRound = CHUNK_OBJECTS * threads * CHUNKS_PER_THREAD;
+
+			for(size_t first = 0; first < objects.size(); first += perRound) {
+				if(baton->cancelPoint()) return false;
+				size_t last = std::min(objects.size(), first + perRound);
+				vector<Chunk> chunks;
+				for(size_t i = first; i < last; i += CHUNK_OBJECTS) {
+					Chunk chunk;
+					chunk.state = state;
+					chunk.objects = &objects[i];
+					chunk.count = std::min(CHUNK_OBJECTS, last - i);
+					chunk.reused = 0;
+					chunk.deltas = 0;
+					chunks.push_back(chunk);
+				}
+
+				WorkQueue queue(threads);
+				for(size_t i = 0; i < chunks.size(); i++) {
+					queue.push(WriteChunk, &chunks[i]);
+				}
+				queue.run();
+
+				if(state->failed) {
+					return Fail(baton, state->errorCode, state->errorMessage);
+				}
+				for(size_t i = 0; i < chunks.size(); i++) {
+					if(!output->write(chunks[i].out)) {
+						return Fail(baton, GITERR_OS, "Pack output was aborted.");
+					}
+					result->reused += chunks[i].reused;
+					result->deltas += chunks[i].deltas;
+				}
+				if(progress) {
+					progress->set(PROGRESS_DONE, last);
+					progress->notify();
+				}
+			}
+			return true;
+		}
+
+		static bool WritePack(Repository *repo, git_odb *odb,
+				const string &packDir, const vector<git_oid> &objects,
+				const Options &options, Sink *sink, Progress *progress,
+				Result *result, Baton *baton) {
+			if(progress) {
+				progress->set(PROGRESS_TOTAL, objects.size());
+				progress->notify();
+			}
+
+			PackSet packs;
+			packs.open(packDir);
+
+			PackState state;
+			state.repo = repo;
+			state.odb = odb;
+			state.packs = &packs;
+			state.sending = objects;
+			std::sort(state.sending.begin(), state.sending.end(), OidLess());
+			state.failed = false;
+			state.errorCode = 0;
+
+			Output output(sink);
+			string header("PACK\0\0\0\2", 8);
+			uint32_t count = objects.size();
+			for(int i = 0; i < 4; i++) {
+				header.push_back((char)(count >> (24 - i * 8)));
+			}
+			if(!output.write(header)) {
+				return Fail(baton, GITERR_OS, "Pack output was aborted.");
+			}
+
+			CREATE_MUTEX(state.lock);
+			CREATE_MUTEX(state.odbLock);
+			bool ok = WriteObjects(&state, objects, options.threads, &output,
+					progress, result, baton);
+			DESTROY_MUTEX(state.odbLock);
+			DESTROY_MUTEX(state.lock);
+			if(!ok) return false;
+
+			if(!output.finish()) {
+				return Fail(baton, GITERR_OS, "Pack output was aborted.");
+			}
+			result->objects = objects.size();
+			result->bytes = output.bytes();
+			return true;
+		}
+
+		bool Run(Repository *repo, const Options &options, Sink *sink,
+				Progress *progress, Result *result, Baton *baton) {
+			memset(result, 0, sizeof(Result));
+
+			vector<git_oid> objects;
+			repo->lockObjects();
+			bool ok = Enumerate(repo->odb_, options, &objects, baton);
+			string packDir = string(git_repository_path(repo->repo_)) +
+					"objects/pack";
+			repo->unlockObjects();
+
+			return ok && WritePack(repo, NULL, packDir, objects, options, sink,
+					progress, result, baton);
+		}
+
+		bool Run(git_repository *repo, const Options &options, Sink *sink,
+				Progress *progress, Result *result, Baton *baton) {
+			memset(result, 0, sizeof(Result));
+
+			git_odb *odb;
+			if(git_repository_odb(&odb, repo) != GIT_OK) {
+				baton->setError(giterr_last());
+				return false;
+			}
+			vector<git_oid> objects;
+			bool ok = Enumerate(odb, options, &objects, baton) &&
+					WritePack(NULL, odb, string(git_repository_path(repo)) +
+					"objects/pack", objects, options, sink, progress, result,
+					baton);
+			git_odb_free(odb);
+			return ok;
+		}
+	};
+}; // namespace gitteh
@@ -0,0 +1,71 @@
+#ifndef GITTEH_PACKER_H
+#define GITTEH_PACKER_H
+
+#include "gitteh.h"
+#include <vector>
+
+namespace gitteh {
+	class Repository;
+	class Progress;
+
+	/**
+		Builds packs the way upload-pack does for a fetch: everything reachable
+		from the wants that isn't reachable from the haves.
+	*/
+	namespace Packer {
+		// Fields reported through Progress, in callback argument order.
+		enum {
+			PROGRESS_DONE,
+			PROGRESS_TOTAL,
+			PROGRESS_FIELDS
+		};
+
+		struct Options {
+			std::vector<git_oid> wants;
+			std::vector<git_oid> haves;
+			int threads;
+			// If set, receives the commits from the haves that the walk
+			// stopped at, before anything is written.
+			std::vector<git_oid> *boundary;
+		};
+
+		struct Result {
+			unsigned int objects;
+			// Written straight from existing packs, without inflating.
+			unsigned int reused;
+			// Of those, how many went out as deltas.
+			unsigned int deltas;
+			uint64_t bytes;
+		};
+
+		// Where the pack goes, in order. Returning false aborts.
+		class Sink {
+		public:
+			virtual ~Sink() { }
+			virtual bool write(const char *data, size_t len) = 0;
+		};
+
+		/**
+			Objects are enumerated under the object lock. Commits are
+			walked from the wants until they hit a commit reachable from the
+			haves, the trees of those boundary commits are left out too.
+
+			The pack is then written in chunks, `threads` at a time. An
+			object that sits in one of the repository's packs is copied out
+			as is, still compressed, after checking its CRC against the .idx.
+			If it's stored as a delta against another object in the same
+			pack that's also being sent, the delta is kept (as a REF_DELTA).
+			Only loose objects, and deltas whose base isn't going, are
+			inflated and deflated again. No new deltas are searched for.
+		*/
+		bool Run(Repository*, const Options&, Sink*, Progress*, Result*, Baton*);
+
+		// Same, from a repository that isn't open as a Repository (the
+		// source of a fetch from a local path). Its objects are read under a
+		// lock the pack keeps for itself.
+		bool Run(git_repository*, const Options&, Sink*, Progress*, Result*,
+				Baton*);
+	};
+}; // namespace gitteh
+
+#endif // GITTEH_PACKER_H
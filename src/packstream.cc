@@ -0,0 +1,242 @@
+#include "packstream.h"
+#include "repository.h"
+#include "progress.h"
+#include "bundle.h"
+
+namespace gitteh {
+	static Persistent<String> class_symbol;
+	static Persistent<String> objects_symbol;
+	static Persistent<String> reused_symbol;
+	static Persistent<String> deltas_symbol;
+	static Persistent<String> bytes_symbol;
+
+	// How much may be waiting for JS before the packer has to wait too.
+	static const size_t MAX_QUEUED = 8 * 1024 * 1024;
+
+	Persistent<FunctionTemplate> PackStream::constructor_template;
+
+	PackStream::PackStream(Repository *repo, const Packer::Options &options,
+			Handle<Value> onData, Handle<Value> callback) : ObjectWrap(),
+			repo_(repo), options_(options) {
+		onData_ = Persistent<Function>::New(Handle<Function>::Cast(onData));
+		baton_.setCallback(callback);
+		memset(&result_, 0, sizeof(result_));
+		queued_ = 0;
+		paused_ = false;
+		aborted_ = false;
+		packed_ = false;
+		finished_ = false;
+		joined_ = false;
+		bundle_ = false;
+		progress_ = NULL;
+
+		CREATE_MUTEX(lock_);
+		CREATE_COND(cond_);
+		uv_async_init(uv_default_loop(), &async_, AsyncData);
+		async_.data = this;
+		repo_->Ref();
+	}
+
+	PackStream::~PackStream() {
+		repo_->Unref();
+		onData_.Dispose();
+		onData_.Clear();
+		DESTROY_COND(cond_);
+		DESTROY_MUTEX(lock_);
+	}
+
+	void PackStream::Init(Handle<Object> target) {
+		HandleScope scope;
+
+		class_symbol = NODE_PSYMBOL("NativePackStream");
+		objects_symbol = NODE_PSYMBOL("objects");
+		reused_symbol = NODE_PSYMBOL("reused");
+		deltas_symbol = NODE_PSYMBOL("deltas");
+		bytes_symbol = NODE_PSYMBOL("bytes");
+
+		Local<FunctionTemplate> t = FunctionTemplate::New(New);
+		constructor_template = Persistent<FunctionTemplate>::New(t);
+		constructor_template->SetClassName(class_symbol);
+		t->InstanceTemplate()->SetInternalFieldCount(1);
+
+		NODE_SET_PROTOTYPE_METHOD(t, "resume", Resume);
+		NODE_SET_PROTOTYPE_METHOD(t, "abort", Abort);
+
+		target->Set(class_symbol, constructor_template->GetFunction());
+	}
+
+	Handle<Value> PackStream::New(const Arguments &args) {
+		HandleScope scope;
+
+		if(args.Length() < 8 ||
+				!Repository::constructor_template->HasInstance(args[0])) {
+			return ThrowException(Exception::TypeError(
+					String::New("Expected a repository.")));
+		}
+		Repository *repo = ObjectWrap::Unwrap<Repository>(args[0]->ToObject());
+
+		Packer::Options options;
+		options.wants = CastFromJS<std::vector<git_oid> >(args[1]);
+		options.haves = CastFromJS<std::vector<git_oid> >(args[2]);
+		options.threads = CastFromJS<int>(args[3]);
+		options.boundary = NULL;
+
+		PackStream *stream = new PackStream(repo, options, args[6], args[7]);
+		stream->Wrap(args.This());
+		if(args[4]->IsArray()) {
+			stream->bundle_ = true;
+			stream->bundleRefs_ = CastFromJS<std::vector<string> >(args[4]);
+		}
+		if(args[5]->IsFunction()) {
+			stream->progress_ = new Progress(args[5], Packer::PROGRESS_FIELDS, 100);
+		}
+
+		// Stays alive until the callback has fired.
+		stream->Ref();
+		if(CREATE_THREAD(stream->thread_, ThreadMain, stream) != 0) {
+			stream->baton_.setError(GITERR_OS, "Failed to start packing thread.");
+			stream->packed_ = true;
+			stream->joined_ = true;
+			uv_async_send(&stream->async_);
+		}
+
+		return args.This();
+	}
+
+	Handle<Value> PackStream::Resume(const Arguments &args) {
+		HandleScope scope;
+		PackStream *stream = ObjectWrap::Unwrap<PackStream>(args.This());
+		if(stream->paused_) {
+			stream->paused_ = false;
+			stream->deliver();
+		}
+		return Undefined();
+	}
+
+	Handle<Value> PackStream::Abort(const Arguments &args) {
+		HandleScope scope;
+		PackStream *stream = ObjectWrap::Unwrap<PackStream>(args.This());
+		if(stream->finished_) return Undefined();
+
+		// Whatever is still coming is dropped, so a paused stream can finish.
+		stream->paused_ = false;
+		LOCK_MUTEX(stream->lock_);
+		stream->aborted_ = true;
+		stream->chunks_.clear();
+		stream->queued_ = 0;
+		SIGNAL_COND(stream->cond_);
+		UNLOCK_MUTEX(stream->lock_);
+		uv_async_send(&stream->async_);
+
+		return Undefined();
+	}
+
+	bool PackStream::write(const char *data, size_t len) {
+		LOCK_MUTEX(lock_);
+		while(queued_ >= MAX_QUEUED && !aborted_) {
+			WAIT_COND(cond_, lock_);
+		}
+		bool ok = !aborted_;
+		if(ok) {
+			chunks_.push_back(string(data, len));
+			queued_ += len;
+		}
+		UNLOCK_MUTEX(lock_);
+
+		if(ok) uv_async_send(&async_);
+		return ok;
+	}
+
+	void *PackStream::ThreadMain(void *payload) {
+		PackStream *stream = static_cast<PackStream*>(payload);
+		if(stream->bundle_) {
+			Bundle::Create(stream->repo_, stream->bundleRefs_, stream->options_,
+					stream, stream->progress_, &stream->result_, &stream->baton_);
+		}
+		else {
+			Packer::Run(stream->repo_, stream->options_, stream,
+					stream->progress_, &stream->result_, &stream->baton_);
+		}
+
+		LOCK_MUTEX(stream->lock_);
+		stream->packed_ = true;
+		UNLOCK_MUTEX(stream->lock_);
+		uv_async_send(&stream->async_);
+		return NULL;
+	}
+
+	void PackStream::AsyncData(uv_async_t *handle, int status) {
+		static_cast<PackStream*>(handle->data)->deliver();
+	}
+
+	/**
+		Hands over whatever has been queued, until onData asks for a break.
+		The lock isn't held while JS runs, so the packer keeps going, and
+		onData is free to call abort().
+	*/
+	void PackStream::deliver() {
+		HandleScope scope;
+
+		while(!paused_ && !finished_) {
+			LOCK_MUTEX(lock_);
+			if(chunks_.empty()) {
+				bool done = packed_;
+				UNLOCK_MUTEX(lock_);
+				if(done) finish();
+				return;
+			}
+			string chunk;
+			chunk.swap(chunks_.front());
+			chunks_.pop_front();
+			queued_ -= chunk.size();
+			SIGNAL_COND(cond_);
+			UNLOCK_MUTEX(lock_);
+
+			Buffer *buffer = Buffer::New(chunk.size());
+			memcpy(Buffer::Data(buffer->handle_), chunk.data(), chunk.size());
+			Handle<Value> argv[] = { MakeFastBuffer(buffer, chunk.size()) };
+
+			TryCatch tryCatch;
+			Handle<Value> more = onData_->Call(Context::GetCurrent()->Global(),
+					1, argv);
+			if(tryCatch.HasCaught()) {
+				FatalException(tryCatch);
+				return;
+			}
+			if(more->IsFalse()) paused_ = true;
+		}
+	}
+
+	void PackStream::finish() {
+		HandleScope scope;
+		finished_ = true;
+		if(!joined_) JOIN_THREAD(thread_);
+		if(progress_) progress_->close();
+
+		// Even if the packer got to the end first, an aborted pack was never
+		// delivered in full.
+		if(aborted_ && !baton_.isErrored()) {
+			baton_.setError(GITERR_OS, "Pack output was aborted.");
+		}
+
+		if(baton_.isErrored()) {
+			Handle<Value> argv[] = { baton_.createV8Error() };
+			FireCallback(baton_.callback, 1, argv);
+		}
+		else {
+			Handle<Object> result = Object::New();
+			result->Set(objects_symbol, CastToJS(result_.objects));
+			result->Set(reused_symbol, CastToJS(result_.reused));
+			result->Set(deltas_symbol, CastToJS(result_.deltas));
+			result->Set(bytes_symbol, Number::New((double)result_.bytes));
+			Handle<Value> argv[] = { Null(), result };
+			FireCallback(baton_.callback, 2, argv);
+		}
+
+		uv_close((uv_handle_t*)&async_, AsyncClose);
+	}
+
+	void PackStream::AsyncClose(uv_handle_t *handle) {
+		static_cast<PackStream*>(((uv_async_t*)handle)->data)->Unref();
+	}
+}; // namespace gitteh
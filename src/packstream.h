@@ -0,0 +1,76 @@
+#ifndef GITTEH_PACKSTREAM_H
+#define GITTEH_PACKSTREAM_H
+
+#include "gitteh.h"
+#include "packer.h"
+#include <deque>
+#include <vector>
+
+namespace gitteh {
+	class Repository;
+	class Progress;
+
+	/**
+		Runs the Packer (or writes a Bundle) and hands the result to JS as
+		it's written, as a series of Buffers passed to onData. If onData returns false delivery stops
+		until resume() is called, and once a few megabytes are waiting the
+		packer itself blocks, so a slow consumer holds back the work rather
+		than piling up memory.
+
+		The packer runs on a thread of its own, not one of the Scheduler's
+		workers: it can be blocked for as long as the consumer likes, and
+		that shouldn't hold up other requests.
+
+		When the whole pack has been delivered, or the packer failed or was
+		abort()ed, callback gets (err, {objects, reused, deltas, bytes}).
+		Keeps itself (and the repository) alive until then.
+	*/
+	class PackStream : public ObjectWrap, public Packer::Sink {
+	public:
+		static Persistent<FunctionTemplate> constructor_template;
+		static void Init(Handle<Object>);
+
+		// Packer::Sink, called on the packer thread.
+		bool write(const char *data, size_t len);
+
+	protected:
+		static Handle<Value> New(const Arguments&);
+		static Handle<Value> Resume(const Arguments&);
+		static Handle<Value> Abort(const Arguments&);
+
+	private:
+		PackStream(Repository*, const Packer::Options&, Handle<Value> onData,
+				Handle<Value> callback);
+		~PackStream();
+
+		void deliver();
+		void finish();
+
+		static void *ThreadMain(void*);
+		static void AsyncData(uv_async_t*, int);
+		static void AsyncClose(uv_handle_t*);
+
+		Repository *repo_;
+		Packer::Options options_;
+		bool bundle_;
+		std::vector<string> bundleRefs_;
+		Progress *progress_;
+		Persistent<Function> onData_;
+		Baton baton_;
+		Packer::Result result_;
+
+		gitteh_thread thread_;
+		uv_async_t async_;
+		gitteh_lock lock_;
+		gitteh_cond cond_;
+		std::deque<string> chunks_;
+		size_t queued_;
+		bool paused_;
+		bool aborted_;
+		bool packed_;
+		bool finished_;
+		bool joined_;
+	};
+}; // namespace gitteh
+
+#endif // GITTEH_PACKSTREAM_H
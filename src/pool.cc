@@ -0,0 +1,41 @@
+#include "pool.h"
+
+namespace gitteh {
+	static Persistent<String> allocated_symbol;
+	static Persistent<String> reused_symbol;
+	static Persistent<String> idle_symbol;
+
+	// Pools are static objects, the list only ever grows during static
+	// initialization. Being a plain pointer, first_ is null before any of
+	// them are constructed.
+	BatonPoolBase *BatonPoolBase::first_;
+
+	BatonPoolBase::BatonPoolBase(const char *name) : name_(name),
+			allocated_(0), reused_(0) {
+		next_ = first_;
+		first_ = this;
+	}
+
+	Handle<Value> BatonPoolBase::Stats(const Arguments &args) {
+		HandleScope scope;
+		Handle<Object> stats = Object::New();
+		for(BatonPoolBase *pool = first_; pool != NULL; pool = pool->next_) {
+			Handle<Object> o = Object::New();
+			o->Set(allocated_symbol, Number::New(pool->allocated_));
+			o->Set(reused_symbol, Number::New(pool->reused_));
+			o->Set(idle_symbol, CastToJS((int)pool->idle()));
+			stats->Set(String::New(pool->name_), o);
+		}
+		return scope.Close(stats);
+	}
+
+	void BatonPoolBase::Init(Handle<Object> target) {
+		HandleScope scope;
+
+		allocated_symbol = NODE_PSYMBOL("allocated");
+		reused_symbol = NODE_PSYMBOL("reused");
+		idle_symbol = NODE_PSYMBOL("idle");
+
+		NODE_SET_METHOD(target, "batonPoolStats", Stats);
+	}
+}; // namespace gitteh
@@ -0,0 +1,84 @@
+#ifndef GITTEH_POOL_H
+#define GITTEH_POOL_H
+
+#include "gitteh.h"
+#include <vector>
+
+namespace gitteh {
+	/**
+		Keeps every BatonPool in a list, so their stats can be handed to JS.
+	*/
+	class BatonPoolBase {
+	public:
+		BatonPoolBase(const char *name);
+
+		static void Init(Handle<Object>);
+
+	protected:
+		// Most idle batons a pool keeps around, the rest are deleted.
+		static const size_t MAX_IDLE = 256;
+
+		virtual size_t idle() const = 0;
+
+		const char *name_;
+		double allocated_;
+		double reused_;
+
+	private:
+		static Handle<Value> Stats(const Arguments&);
+
+		BatonPoolBase *next_;
+		static BatonPoolBase *first_;
+	};
+
+	/**
+		Free list of batons of one type, for the calls made often enough that
+		new/delete of the baton and its members shows up. A released baton
+		keeps its strings and containers, so their buffers get reused by the
+		next request too. T needs a default constructor, and a clear() that
+		lets go of whatever the last request left in it (references held,
+		libgit2 objects and the like).
+
+		Main thread only, like everything else that creates and deletes
+		batons.
+	*/
+	template<typename T>
+	class BatonPool : public BatonPoolBase {
+	public:
+		BatonPool(const char *name) : BatonPoolBase(name) { }
+
+		T *acquire() {
+			if(free_.empty()) {
+				allocated_++;
+				return new T();
+			}
+			reused_++;
+			T *baton = free_.back();
+			free_.pop_back();
+			baton->reset();
+			return baton;
+		}
+
+		void release(T *baton) {
+			baton->clear();
+			// Drops the callback, an idle baton shouldn't keep it alive.
+			baton->reset();
+			if(free_.size() < MAX_IDLE) {
+				free_.push_back(baton);
+			}
+			else {
+				delete baton;
+			}
+		}
+
+	protected:
+		size_t idle() const {
+			return free_.size();
+		}
+
+	private:
+		std::vector<T*> free_;
+	};
+}; // namespace gitteh
+
+#endif // GITTEH_POOL_H
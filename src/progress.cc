@@ -0,0 +1,70 @@
+#include "progress.h"
+
+namespace gitteh {
+	Progress::Progress(Handle<Value> callback, int fields, int interval) :
+			values_(fields, 0) {
+		callback_ = Persistent<Function>::New(Handle<Function>::Cast(callback));
+		interval_ = (uint64_t)interval * 1000000;
+		lastNotify_ = 0;
+
+		CREATE_MUTEX(lock_);
+		uv_async_init(uv_default_loop(), &async_, AsyncCallback);
+		async_.data = this;
+	}
+
+	Progress::~Progress() {
+		callback_.Dispose();
+		callback_.Clear();
+		DESTROY_MUTEX(lock_);
+	}
+
+	void Progress::set(int field, double value) {
+		LOCK_MUTEX(lock_);
+		values_[field] = value;
+		UNLOCK_MUTEX(lock_);
+	}
+
+	void Progress::add(int field, double delta) {
+		LOCK_MUTEX(lock_);
+		values_[field] += delta;
+		UNLOCK_MUTEX(lock_);
+	}
+
+	void Progress::notify() {
+		uint64_t now = uv_hrtime();
+
+		LOCK_MUTEX(lock_);
+		bool send = now - lastNotify_ >= interval_;
+		if(send) lastNotify_ = now;
+		UNLOCK_MUTEX(lock_);
+
+		if(send) uv_async_send(&async_);
+	}
+
+	void Progress::close() {
+		fire();
+		uv_close((uv_handle_t*)&async_, AsyncClose);
+	}
+
+	void Progress::fire() {
+		HandleScope scope;
+
+		LOCK_MUTEX(lock_);
+		std::vector<double> values = values_;
+		UNLOCK_MUTEX(lock_);
+
+		std::vector<Handle<Value> > argv;
+		for(size_t i = 0; i < values.size(); i++) {
+			argv.push_back(Number::New(values[i]));
+		}
+		FireCallback(callback_, argv.size(), &argv[0]);
+	}
+
+	void Progress::AsyncCallback(uv_async_t *handle, int status) {
+		static_cast<Progress*>(handle->data)->fire();
+	}
+
+	void Progress::AsyncClose(uv_handle_t *handle) {
+		delete static_cast<Progress*>(((uv_async_t*)handle)->data);
+	}
+}; // namespace gitteh
@@ -0,0 +1,46 @@
+#ifndef GITTEH_PROGRESS_H
+#define GITTEH_PROGRESS_H
+
+#include "gitteh.h"
+#include <vector>
+
+namespace gitteh {
+	/**
+		Delivers progress of a long running native operation to a JS callback.
+		Worker threads update a fixed number of numeric fields and call
+		notify(), which wakes the main thread through a uv_async handle. libuv
+		coalesces wakeups, and notifications closer together than `interval`
+		milliseconds are dropped, so the callback runs at most a handful of
+		times per second no matter how many files/objects are processed.
+
+		Must be created and closed on the main thread. close() fires the
+		callback one last time with the final values, after that the object
+		deletes itself once libuv is done with the handle.
+	*/
+	class Progress {
+	public:
+		Progress(Handle<Value> callback, int fields, int interval);
+
+		void set(int field, double value);
+		void add(int field, double delta);
+		void notify();
+
+		void close();
+
+	private:
+		~Progress();
+
+		uv_async_t async_;
+		Persistent<Function> callback_;
+		gitteh_lock lock_;
+		std::vector<double> values_;
+		uint64_t interval_;
+		uint64_t lastNotify_;
+
+		void fire();
+		static void AsyncCallback(uv_async_t*, int);
+		static void AsyncClose(uv_handle_t*);
+	};
+}; // namespace gitteh
+
+#endif // GITTEH_PROGRESS_H
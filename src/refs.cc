@@ -0,0 +1,961 @@
+#include "refs.h"
+#include "repository.h"
+#include <algorithm>
+#include <cstdio>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <utime.h>
+
+using std::vector;
+
+namespace gitteh {
+	namespace Refs {
+		static const char *PACKED_HEADER = "# pack-refs with: peeled \n";
+
+		/**
+			Git style lock on a file: we own path while path.lock exists. The
+			new contents are written to the lock, and commit() renames it over
+			the original. Anything not committed is rolled back on destruction.
+		*/
+		class LockFile {
+		public:
+			LockFile(const string &path) : path_(path), lockPath_(path + ".lock"),
+					fd_(-1), locked_(false) { }
+
+			~LockFile() {
+				rollback();
+			}
+
+			bool lock() {
+				for(size_t i = 1; i < lockPath_.size(); i++) {
+					if(lockPath_[i] == '/') {
+						mkdir(lockPath_.substr(0, i).c_str(), 0777);
+					}
+				}
+
+				fd_ = open(lockPath_.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+				locked_ = fd_ >= 0;
+				return locked_;
+			}
+
+			bool write(const string &data) {
+				const char *buf = data.data();
+				size_t len = data.size();
+				while(len > 0) {
+					ssize_t written = ::write(fd_, buf, len);
+					if(written < 0) {
+						if(errno == EINTR) continue;
+						return false;
+					}
+					buf += written;
+					len -= written;
+				}
+				return true;
+			}
+
+			bool commit() {
+				if(close(fd_) < 0) return false;
+				fd_ = -1;
+				if(rename(lockPath_.c_str(), path_.c_str()) < 0) return false;
+				locked_ = false;
+				return true;
+			}
+
+			void rollback() {
+				if(fd_ >= 0) {
+					close(fd_);
+					fd_ = -1;
+				}
+				if(locked_) {
+					unlink(lockPath_.c_str());
+					locked_ = false;
+				}
+			}
+
+		private:
+			string path_;
+			string lockPath_;
+			int fd_;
+			bool locked_;
+		};
+
+		// What a file held before a batch touched it, to put back if a later
+		// step of the batch fails.
+		struct Backup {
+			bool existed;
+			string data;
+		};
+
+		static bool ReadBackup(const string &path, Backup *backup) {
+			backup->existed = false;
+			backup->data.clear();
+			int fd = open(path.c_str(), O_RDONLY);
+			if(fd < 0) return errno == ENOENT;
+
+			char buf[4096];
+			ssize_t result;
+			while((result = read(fd, buf, sizeof(buf))) != 0) {
+				if(result < 0) {
+					if(errno == EINTR) continue;
+					close(fd);
+					return false;
+				}
+				backup->data.append(buf, result);
+			}
+			close(fd);
+			backup->existed = true;
+			return true;
+		}
+
+		/**
+			Puts data at path by way of a file next to it, so readers only ever
+			see the old or the new contents. Unlike LockFile::commit() this
+			leaves the lock held, so the change can still be undone. The
+			temporary name ends in .lock, so it's never taken for a ref.
+		*/
+		static bool ReplaceFile(const string &path, const string &data) {
+			string tempPath = path + ".new.lock";
+			int fd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+			if(fd < 0) return false;
+
+			const char *buf = data.data();
+			size_t len = data.size();
+			bool ok = true;
+			while(ok && len > 0) {
+				ssize_t written = ::write(fd, buf, len);
+				if(written < 0) {
+					ok = errno == EINTR;
+					continue;
+				}
+				buf += written;
+				len -= written;
+			}
+			if(close(fd) < 0) ok = false;
+			if(ok && rename(tempPath.c_str(), path.c_str()) < 0) ok = false;
+			if(!ok) unlink(tempPath.c_str());
+			return ok;
+		}
+
+		static bool RemoveFile(const string &path) {
+			return unlink(path.c_str()) == 0 || errno == ENOENT;
+		}
+
+		static void RestoreBackup(const string &path, const Backup &backup) {
+			if(backup.existed) {
+				ReplaceFile(path, backup.data);
+			}
+			else {
+				RemoveFile(path);
+			}
+		}
+
+		static bool IsZero(const git_oid &oid) {
+			for(int i = 0; i < GIT_OID_RAWSZ; i++) {
+				if(oid.id[i]) return false;
+			}
+			return true;
+		}
+
+		static string FormatOid(const git_oid &oid) {
+			char hex[GIT_OID_HEXSZ + 1];
+			hex[GIT_OID_HEXSZ] = 0;
+			git_oid_fmt(hex, &oid);
+			return string(hex);
+		}
+
+		// Roughly git's check-ref-format, restricted to refs/.
+		static bool IsValidName(const string &name) {
+			if(name.size() <= 5 || name.compare(0, 5, "refs/")) return false;
+
+			char last = name[name.size() - 1];
+			if(last == '/' || last == '.') return false;
+			if(name.find("..") != string::npos || name.find("//") != string::npos ||
+					name.find("/.") != string::npos || name.find("@{") != string::npos ||
+					name.find(".lock/") != string::npos) {
+				return false;
+			}
+			if(name.size() >= 5 && !name.compare(name.size() - 5, 5, ".lock")) {
+				return false;
+			}
+
+			for(size_t i = 0; i < name.size(); i++) {
+				unsigned char c = name[i];
+				if(c <= ' ' || c == 0x7f || strchr("~^:?*[\\", c)) return false;
+			}
+			return true;
+		}
+
+		static int CompareName(const char *a, size_t aLen, const char *b,
+				size_t bLen) {
+			int result = memcmp(a, b, std::min(aLen, bLen));
+			if(result) return result;
+			return aLen < bLen ? -1 : (aLen > bLen ? 1 : 0);
+		}
+
+		struct PackedIndex::EntryLess {
+			bool operator()(const Entry &a, const Entry &b) const {
+				return CompareName(a.name, a.nameLen, b.name, b.nameLen) < 0;
+			}
+			bool operator()(const Entry &a, const string &b) const {
+				return CompareName(a.name, a.nameLen, b.data(), b.size()) < 0;
+			}
+		};
+
+		PackedIndex::PackedIndex(const string &path) : path_(path), data_(NULL),
+				size_(0), loaded_(false), dev_(0), ino_(0), mtime_(0) { }
+
+		PackedIndex::~PackedIndex() {
+			unload();
+		}
+
+		void PackedIndex::unload() {
+			if(data_) {
+				munmap(data_, size_);
+				data_ = NULL;
+			}
+			size_ = 0;
+			entries_.clear();
+			loaded_ = false;
+		}
+
+		void PackedIndex::invalidate() {
+			unload();
+		}
+
+		bool PackedIndex::refresh() {
+			struct stat st;
+			if(stat(path_.c_str(), &st) < 0) {
+				unload();
+				if(errno != ENOENT) return false;
+				loaded_ = true;
+				dev_ = 0;
+				ino_ = 0;
+				mtime_ = 0;
+				return true;
+			}
+
+			if(loaded_ && st.st_dev == dev_ && st.st_ino == ino_ &&
+					(size_t)st.st_size == size_ && st.st_mtime == mtime_) {
+				return true;
+			}
+
+			unload();
+			dev_ = st.st_dev;
+			ino_ = st.st_ino;
+			mtime_ = st.st_mtime;
+			size_ = st.st_size;
+			if(!load()) {
+				unload();
+				return false;
+			}
+			loaded_ = true;
+			return true;
+		}
+
+		bool PackedIndex::load() {
+			if(size_ == 0) return true;
+
+			int fd = open(path_.c_str(), O_RDONLY);
+			if(fd < 0) return false;
+			void *map = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+			close(fd);
+			if(map == MAP_FAILED) return false;
+			data_ = static_cast<char*>(map);
+
+			const char *pos = data_;
+			const char *end = data_ + size_;
+			git_oid oid;
+			bool sorted = true;
+			while(pos < end) {
+				const char *eol = static_cast<const char*>(
+						memchr(pos, '\n', end - pos));
+				if(eol == NULL) eol = end;
+				size_t len = eol - pos;
+				const char *line = pos;
+				pos = eol + 1;
+
+				if(len == 0 || line[0] == '#') continue;
+
+				if(line[0] == '^') {
+					if(entries_.empty() || len < GIT_OID_HEXSZ + 1 ||
+							git_oid_fromstrn(&oid, line + 1, GIT_OID_HEXSZ) != GIT_OK) {
+						return false;
+					}
+					entries_.back().peel = line + 1;
+					continue;
+				}
+
+				if(len < GIT_OID_HEXSZ + 2 || line[GIT_OID_HEXSZ] != ' ' ||
+						git_oid_fromstrn(&oid, line, GIT_OID_HEXSZ) != GIT_OK) {
+					return false;
+				}
+
+				Entry entry;
+				entry.oid = line;
+				entry.name = line + GIT_OID_HEXSZ + 1;
+				entry.nameLen = len - GIT_OID_HEXSZ - 1;
+				entry.peel = NULL;
+				if(sorted && !entries_.empty() &&
+						!EntryLess()(entries_.back(), entry)) {
+					sorted = false;
+				}
+				entries_.push_back(entry);
+			}
+
+			// Files git wrote are already sorted. Anything else gets sorted
+			// here, a later duplicate of a name is dropped.
+			if(!sorted) {
+				std::stable_sort(entries_.begin(), entries_.end(), EntryLess());
+				vector<Entry> unique;
+				for(size_t i = 0; i < entries_.size(); i++) {
+					if(!unique.empty() && !EntryLess()(unique.back(), entries_[i])) {
+						continue;
+					}
+					unique.push_back(entries_[i]);
+				}
+				entries_.swap(unique);
+			}
+			return true;
+		}
+
+		size_t PackedIndex::lowerBound(const string &name) const {
+			return std::lower_bound(entries_.begin(), entries_.end(), name,
+					EntryLess()) - entries_.begin();
+		}
+
+		void PackedIndex::get(size_t i, PackedRef *ref) const {
+			const Entry &entry = entries_[i];
+			ref->name.assign(entry.name, entry.nameLen);
+			git_oid_fromstrn(&ref->oid, entry.oid, GIT_OID_HEXSZ);
+			ref->hasPeel = entry.peel != NULL;
+			if(ref->hasPeel) {
+				git_oid_fromstrn(&ref->peel, entry.peel, GIT_OID_HEXSZ);
+			}
+		}
+
+		bool PackedIndex::lookup(const string &name, PackedRef *ref) const {
+			size_t i = lowerBound(name);
+			if(i == entries_.size() || CompareName(entries_[i].name,
+					entries_[i].nameLen, name.data(), name.size())) {
+				return false;
+			}
+			get(i, ref);
+			return true;
+		}
+
+		void PackedIndex::list(const string &prefix, vector<PackedRef> *refs) const {
+			for(size_t i = lowerBound(prefix); i < entries_.size(); i++) {
+				const Entry &entry = entries_[i];
+				if(entry.nameLen < prefix.size() ||
+						memcmp(entry.name, prefix.data(), prefix.size())) {
+					break;
+				}
+				refs->push_back(PackedRef());
+				get(i, &refs->back());
+			}
+		}
+
+		size_t PackedIndex::size() const {
+			return entries_.size();
+		}
+
+		bool ReadPacked(const string &path, PackedRefMap *refs) {
+			PackedIndex index(path);
+			if(!index.refresh()) return false;
+
+			vector<PackedRef> list;
+			index.list("", &list);
+			for(size_t i = 0; i < list.size(); i++) {
+				(*refs)[list[i].name] = list[i];
+			}
+			return true;
+		}
+
+		// Fills in the peeled target for annotated tags, packed-refs claims
+		// to be "peeled" so readers rely on it being there.
+		static void Peel(git_repository *repo, PackedRef *ref) {
+			ref->hasPeel = false;
+			if(ref->name.compare(0, 10, "refs/tags/")) return;
+
+			git_object *obj;
+			if(git_object_lookup(&obj, repo, &ref->oid, GIT_OBJ_ANY) != GIT_OK) {
+				return;
+			}
+			while(git_object_type(obj) == GIT_OBJ_TAG) {
+				git_object *target;
+				if(git_tag_target(&target, (git_tag*)obj) != GIT_OK) break;
+				git_object_free(obj);
+				obj = target;
+				ref->hasPeel = true;
+			}
+			if(ref->hasPeel) ref->peel = *git_object_id(obj);
+			git_object_free(obj);
+		}
+
+		static string FormatPacked(const PackedRefMap &refs) {
+			string data = PACKED_HEADER;
+			for(PackedRefMap::const_iterator it = refs.begin(); it != refs.end(); ++it) {
+				data += FormatOid(it->second.oid) + " " + it->first + "\n";
+				if(it->second.hasPeel) {
+					data += "^" + FormatOid(it->second.peel) + "\n";
+				}
+			}
+			return data;
+		}
+
+		/**
+			libgit2 only reloads its packed-refs cache when the file's mtime
+			changes, and that has one second granularity. If we rewrote it
+			within the same second it was last loaded, nudge mtime forward.
+		*/
+		static void TouchPacked(const string &path, const struct stat &before) {
+			struct stat after;
+			if(stat(path.c_str(), &after) < 0) return;
+			if(after.st_mtime != before.st_mtime) return;
+
+			struct utimbuf times;
+			times.actime = after.st_atime;
+			times.modtime = after.st_mtime + 1;
+			utime(path.c_str(), &times);
+		}
+
+		// Looks up the current direct value of a ref. exists is false if
+		// there's no such ref.
+		static bool CurrentValue(git_repository *repo, const string &name,
+				bool *exists, git_oid *oid, Baton *baton) {
+			git_reference *ref;
+			int result = git_reference_lookup(&ref, repo, name.c_str());
+			if(result == GIT_ENOTFOUND) {
+				*exists = false;
+				return true;
+			}
+			if(!AsyncLibCall(result, baton)) return false;
+
+			*exists = true;
+			bool ok = git_reference_type(ref) == GIT_REF_OID;
+			if(ok) {
+				*oid = *git_reference_oid(ref);
+			}
+			else {
+				baton->setError(GITERR_REFERENCE, "Reference '" + name +
+						"' is symbolic.");
+			}
+			git_reference_free(ref);
+			return ok;
+		}
+
+		static bool ApplyLocked(git_repository *repo, git_odb *odb,
+				const vector<Update> &updates, bool packed,
+				vector<Change> *changes, Baton *baton) {
+			string gitDir = git_repository_path(repo);
+			size_t count = updates.size();
+
+			vector<string> names;
+			for(size_t i = 0; i < count; i++) {
+				const Update &update = updates[i];
+				if(!IsValidName(update.name)) {
+					baton->setError(GITERR_REFERENCE, "Invalid reference name '" +
+							update.name + "'.");
+					return false;
+				}
+				if(!IsZero(update.newOid) &&
+						!git_odb_exists(odb, &update.newOid)) {
+					baton->setError(GITERR_REFERENCE, "Target of '" + update.name +
+							"' (" + FormatOid(update.newOid) + ") doesn't exist.");
+					return false;
+				}
+				names.push_back(update.name);
+			}
+			std::sort(names.begin(), names.end());
+			if(std::adjacent_find(names.begin(), names.end()) != names.end()) {
+				baton->setError(GITERR_REFERENCE,
+						"Reference updated more than once.");
+				return false;
+			}
+
+			// Lock everything first. Once we hold every lock nobody (git
+			// included) can move these refs, so the old value checks below
+			// stay true until we're done.
+			vector<LockFile*> locks;
+			bool ok = true;
+			for(size_t i = 0; ok && i < count; i++) {
+				locks.push_back(new LockFile(gitDir + updates[i].name));
+				if(!locks.back()->lock()) {
+					baton->setError(GITERR_REFERENCE, "Unable to lock '" +
+							updates[i].name + "'.");
+					ok = false;
+				}
+			}
+
+			bool rewritePacked = packed;
+			vector<git_oid> previous(count);
+			for(size_t i = 0; ok && i < count; i++) {
+				const Update &update = updates[i];
+				bool exists;
+				git_oid current;
+				if(!CurrentValue(repo, update.name, &exists, &current, baton)) {
+					ok = false;
+					break;
+				}
+				if(exists) {
+					previous[i] = current;
+				}
+				else {
+					memset(&previous[i], 0, sizeof(git_oid));
+				}
+
+				if(update.checkOld) {
+					bool matches = IsZero(update.oldOid) ? !exists :
+							exists && !git_oid_cmp(&current, &update.oldOid);
+					if(!matches) {
+						baton->setError(GITERR_REFERENCE, "Reference '" +
+								update.name + "' is at " +
+								(exists ? FormatOid(current) : "nothing") +
+								", expected " + FormatOid(update.oldOid) + ".");
+						ok = false;
+						break;
+					}
+				}
+
+				// A ref can be both loose and packed, lookup only tells us about
+				// the loose one. Deletions always go through packed-refs.
+				if(IsZero(update.newOid)) rewritePacked = true;
+			}
+
+			string packedPath = gitDir + "packed-refs";
+			LockFile packedLock(packedPath);
+			struct stat packedStat;
+			memset(&packedStat, 0, sizeof(struct stat));
+			string packedData;
+			Backup packedBackup;
+
+			if(ok && rewritePacked) {
+				PackedRefMap refs;
+				stat(packedPath.c_str(), &packedStat);
+
+				if(!packedLock.lock()) {
+					baton->setError(GITERR_REFERENCE, "Unable to lock packed-refs.");
+					ok = false;
+				}
+				else if(!ReadBackup(packedPath, &packedBackup) ||
+						!ReadPacked(packedPath, &refs)) {
+					baton->setError(GITERR_REFERENCE, "Corrupted packed-refs.");
+					ok = false;
+				}
+
+				for(size_t i = 0; ok && i < count; i++) {
+					const Update &update = updates[i];
+					if(IsZero(update.newOid)) {
+						refs.erase(update.name);
+					}
+					else if(packed) {
+						PackedRef &ref = refs[update.name];
+						ref.name = update.name;
+						ref.oid = update.newOid;
+						Peel(repo, &ref);
+					}
+				}
+				if(ok) packedData = FormatPacked(refs);
+			}
+
+			vector<Backup> backups(count);
+			for(size_t i = 0; ok && i < count; i++) {
+				if(!ReadBackup(gitDir + updates[i].name, &backups[i])) {
+					baton->setError(GITERR_OS, "Failed to read '" +
+							updates[i].name + "'.");
+					ok = false;
+				}
+			}
+
+			// Everything has been checked, and every file involved is locked
+			// (and stays locked until the end). Loose refs are written first,
+			// then packed-refs, then loose copies that would shadow the packed
+			// value (or resurrect a deleted ref) are removed. If any step fails
+			// the ones before it are undone from the backups, so the batch is
+			// applied whole or not at all.
+			size_t written = 0;
+			bool packedWritten = false;
+			size_t removed = 0;
+			for(; ok && written < count; written++) {
+				if(packed || IsZero(updates[written].newOid)) continue;
+				if(!ReplaceFile(gitDir + updates[written].name,
+						FormatOid(updates[written].newOid) + "\n")) {
+					baton->setError(GITERR_OS, "Failed to update '" +
+							updates[written].name + "'.");
+					ok = false;
+					break;
+				}
+			}
+			if(ok && rewritePacked) {
+				packedWritten = ReplaceFile(packedPath, packedData);
+				if(!packedWritten) {
+					baton->setError(GITERR_OS, "Failed to update packed-refs.");
+					ok = false;
+				}
+			}
+			for(; ok && removed < count; removed++) {
+				if(!packed && !IsZero(updates[removed].newOid)) continue;
+				if(!RemoveFile(gitDir + updates[removed].name)) {
+					baton->setError(GITERR_OS, "Failed to remove '" +
+							updates[removed].name + "'.");
+					ok = false;
+					break;
+				}
+			}
+
+			if(!ok) {
+				for(size_t i = 0; i < removed; i++) {
+					if(packed || IsZero(updates[i].newOid)) {
+						RestoreBackup(gitDir + updates[i].name, backups[i]);
+					}
+				}
+				if(packedWritten) RestoreBackup(packedPath, packedBackup);
+				for(size_t i = 0; i < written; i++) {
+					if(!packed && !IsZero(updates[i].newOid)) {
+						RestoreBackup(gitDir + updates[i].name, backups[i]);
+					}
+				}
+			}
+			if(packedWritten) TouchPacked(packedPath, packedStat);
+
+			for(size_t i = 0; i < locks.size(); i++) {
+				delete locks[i];
+			}
+
+			for(size_t i = 0; ok && changes && i < count; i++) {
+				if(!git_oid_cmp(&previous[i], &updates[i].newOid)) continue;
+				Change change;
+				change.name = updates[i].name;
+				change.oldOid = previous[i];
+				change.newOid = updates[i].newOid;
+				changes->push_back(change);
+			}
+
+			return ok;
+		}
+
+		/**
+			Reads a loose ref file. If symbolic isn't NULL it receives the
+			target of a symbolic ref, otherwise only direct refs are accepted.
+		*/
+		static bool ReadLoose(const string &path, git_oid *oid,
+				string *symbolic) {
+			int fd = open(path.c_str(), O_RDONLY);
+			if(fd < 0) return false;
+
+			char buf[1024];
+			size_t len = 0;
+			while(len < sizeof(buf)) {
+				ssize_t result = read(fd, buf + len, sizeof(buf) - len);
+				if(result < 0 && errno == EINTR) continue;
+				if(result <= 0) break;
+				len += result;
+			}
+			close(fd);
+
+			while(len > 0 && isspace((unsigned char)buf[len - 1])) len--;
+
+			if(len > 5 && !memcmp(buf, "ref: ", 5)) {
+				if(symbolic == NULL) return false;
+				symbolic->assign(buf + 5, len - 5);
+				memset(oid, 0, sizeof(git_oid));
+				return true;
+			}
+
+			if(symbolic) symbolic->clear();
+			return len == GIT_OID_HEXSZ &&
+					git_oid_fromstrn(oid, buf, GIT_OID_HEXSZ) == GIT_OK;
+		}
+
+		struct LooseRef {
+			string name;
+			git_oid oid;
+			// Empty for direct refs.
+			string symbolic;
+
+			bool operator<(const LooseRef &other) const {
+				return name < other.name;
+			}
+		};
+
+		static void CollectLoose(const string &gitDir, const string &name,
+				bool symbolic, vector<LooseRef> *refs) {
+			DIR *dir = opendir((gitDir + name).c_str());
+			if(dir == NULL) return;
+
+			struct dirent *entry;
+			while((entry = readdir(dir)) != NULL) {
+				string file = entry->d_name;
+				if(file == "." || file == "..") continue;
+				if(file.size() >= 5 && !file.compare(file.size() - 5, 5, ".lock")) {
+					continue;
+				}
+
+				string child = name + "/" + file;
+				struct stat st;
+				if(lstat((gitDir + child).c_str(), &st) < 0) continue;
+
+				if(S_ISDIR(st.st_mode)) {
+					CollectLoose(gitDir, child, symbolic, refs);
+				}
+				else if(S_ISREG(st.st_mode)) {
+					LooseRef ref;
+					ref.name = child;
+					if(ReadLoose(gitDir + child, &ref.oid,
+							symbolic ? &ref.symbolic : NULL)) {
+						refs->push_back(ref);
+					}
+				}
+			}
+			closedir(dir);
+		}
+
+		// Removes directories left empty by pruning, up to (not including)
+		// the refs/<kind> directories git expects to exist.
+		static void RemoveEmptyParents(const string &gitDir, string name) {
+			size_t slash;
+			while((slash = name.rfind('/')) != string::npos) {
+				name = name.substr(0, slash);
+				if(std::count(name.begin(), name.end(), '/') < 2) break;
+				if(rmdir((gitDir + name).c_str()) < 0) break;
+			}
+		}
+
+		static bool PackLocked(Repository *repo, bool prune, PackResult *result,
+				Baton *baton) {
+			string gitDir = git_repository_path(repo->repo_);
+			string packedPath = gitDir + "packed-refs";
+			result->packed = 0;
+			result->pruned = 0;
+
+			LockFile packedLock(packedPath);
+			if(!packedLock.lock()) {
+				baton->setError(GITERR_REFERENCE, "Unable to lock packed-refs.");
+				return false;
+			}
+
+			struct stat packedStat;
+			memset(&packedStat, 0, sizeof(struct stat));
+			stat(packedPath.c_str(), &packedStat);
+
+			PackedRefMap refs;
+			if(!ReadPacked(packedPath, &refs)) {
+				baton->setError(GITERR_REFERENCE, "Corrupted packed-refs.");
+				return false;
+			}
+
+			vector<LooseRef> loose;
+			CollectLoose(gitDir, "refs", false, &loose);
+			for(size_t i = 0; i < loose.size(); i++) {
+				PackedRef &ref = refs[loose[i].name];
+				ref.name = loose[i].name;
+				ref.oid = loose[i].oid;
+				Peel(repo->repo_, &ref);
+			}
+
+			if(!packedLock.write(FormatPacked(refs)) || !packedLock.commit()) {
+				baton->setError(GITERR_OS, "Failed to write packed-refs.");
+				return false;
+			}
+			TouchPacked(packedPath, packedStat);
+			result->packed = loose.size();
+
+			if(!prune) return true;
+
+			for(size_t i = 0; i < loose.size(); i++) {
+				string path = gitDir + loose[i].name;
+				LockFile lock(path);
+				if(!lock.lock()) continue;
+
+				// Somebody may have moved it since we packed it, in which
+				// case the loose value is the real one and has to stay.
+				git_oid current;
+				if(ReadLoose(path, &current, NULL) &&
+						!git_oid_cmp(&current, &loose[i].oid) &&
+						unlink(path.c_str()) == 0) {
+					result->pruned++;
+				}
+				lock.rollback();
+				RemoveEmptyParents(gitDir, loose[i].name);
+			}
+			return true;
+		}
+
+		// Annotated tags found in loose refs, or packed outside refs/tags/
+		// (where git doesn't record peeled values), have to be looked at.
+		static void PeelListed(Repository *repo, ListedRef *ref) {
+			size_t size;
+			git_otype type;
+			if(git_odb_read_header(&size, &type, repo->odb_, &ref->oid) != GIT_OK ||
+					type != GIT_OBJ_TAG) {
+				return;
+			}
+
+			PackedRef packed;
+			packed.name = "refs/tags/";
+			packed.oid = ref->oid;
+			Peel(repo->repo_, &packed);
+			ref->hasPeel = packed.hasPeel;
+			ref->peel = packed.peel;
+		}
+
+		static void AddListed(Repository *repo, const ListOptions &options,
+				const string &name, const git_oid &oid, const string &symbolic,
+				const PackedRef *packed, vector<ListedRef> *refs) {
+			refs->push_back(ListedRef());
+			ListedRef &ref = refs->back();
+			ref.name = name;
+			ref.direct = symbolic.empty();
+			ref.hasOid = ref.direct;
+			ref.oid = oid;
+			ref.hasPeel = false;
+			ref.target = ref.direct ? FormatOid(oid) : symbolic;
+
+			if(!ref.direct && options.resolve) {
+				git_reference *symRef, *resolved;
+				if(git_reference_lookup(&symRef, repo->repo_, name.c_str()) == GIT_OK) {
+					if(git_reference_resolve(&resolved, symRef) == GIT_OK) {
+						ref.hasOid = true;
+						ref.oid = *git_reference_oid(resolved);
+						git_reference_free(resolved);
+					}
+					git_reference_free(symRef);
+				}
+				// A dangling symbolic ref just stays unresolved.
+				giterr_clear();
+			}
+
+			if(!options.peelTags || !ref.hasOid) return;
+
+			if(packed && packed->hasPeel) {
+				ref.hasPeel = true;
+				ref.peel = packed->peel;
+			}
+			else if(!packed || name.compare(0, 10, "refs/tags/")) {
+				PeelListed(repo, &ref);
+			}
+		}
+
+		static bool Matches(const ListOptions &options, const string &name) {
+			if(name.compare(0, options.prefix.size(), options.prefix)) return false;
+			if(!options.after.empty() && name <= options.after) return false;
+			return options.glob.empty() ||
+					fnmatch(options.glob.c_str(), name.c_str(), FNM_PATHNAME) == 0;
+		}
+
+		// Moves *i to the next packed ref that matches, false if there's none.
+		static bool NextPacked(const PackedIndex *index,
+				const ListOptions &options, size_t *i, PackedRef *ref) {
+			for(; *i < index->size(); (*i)++) {
+				index->get(*i, ref);
+				// Sorted, so once the prefix stops matching we're done.
+				if(ref->name.compare(0, options.prefix.size(), options.prefix)) {
+					break;
+				}
+				if(Matches(options, ref->name)) return true;
+			}
+			*i = index->size();
+			return false;
+		}
+
+		static bool ListLocked(Repository *repo, const ListOptions &options,
+				vector<ListedRef> *refs, bool *more, Baton *baton) {
+			*more = false;
+
+			PackedIndex *index = repo->packedRefs_;
+			if(!index->refresh()) {
+				baton->setError(GITERR_REFERENCE, "Corrupted packed-refs.");
+				return false;
+			}
+
+			// Loose refs are few compared to packed ones, so they're all read
+			// and filtered up front. Only the deepest directory the prefix
+			// names needs walking.
+			string gitDir = git_repository_path(repo->repo_);
+			vector<LooseRef> found, loose;
+			CollectLoose(gitDir, options.prefix.substr(0,
+					options.prefix.rfind('/')), true, &found);
+			for(size_t i = 0; i < found.size(); i++) {
+				if(Matches(options, found[i].name)) loose.push_back(found[i]);
+			}
+			std::sort(loose.begin(), loose.end());
+
+			size_t looseIdx = 0;
+			size_t packedIdx = index->lowerBound(
+					std::max(options.prefix, options.after));
+			PackedRef packed;
+			bool havePacked = NextPacked(index, options, &packedIdx, &packed);
+
+			while(havePacked || looseIdx < loose.size()) {
+				if(options.limit && refs->size() == options.limit) {
+					*more = true;
+					break;
+				}
+
+				if(looseIdx < loose.size() &&
+						(!havePacked || loose[looseIdx].name <= packed.name)) {
+					const LooseRef &ref = loose[looseIdx++];
+					AddListed(repo, options, ref.name, ref.oid, ref.symbolic,
+							NULL, refs);
+
+					// The loose copy shadows the packed one.
+					if(!havePacked || ref.name != packed.name) continue;
+				}
+				else {
+					AddListed(repo, options, packed.name, packed.oid, "", &packed,
+							refs);
+				}
+				packedIdx++;
+				havePacked = NextPacked(index, options, &packedIdx, &packed);
+			}
+
+			return true;
+		}
+
+		bool List(Repository *repo, const ListOptions &options,
+				vector<ListedRef> *refs, bool *more, Baton *baton) {
+			repo->lockRefs();
+			repo->lockObjects();
+			bool ok = ListLocked(repo, options, refs, more, baton);
+			repo->unlockObjects();
+			repo->unlockRefs();
+			return ok;
+		}
+
+		bool Pack(Repository *repo, bool prune, PackResult *result,
+				Baton *baton) {
+			repo->lockRefs();
+			repo->lockObjects();
+			bool ok = PackLocked(repo, prune, result, baton);
+			repo->unlockObjects();
+			repo->packedRefs_->invalidate();
+			repo->unlockRefs();
+			return ok;
+		}
+
+		bool Apply(git_repository *repo, git_odb *odb,
+				const vector<Update> &updates, bool packed, Baton *baton,
+				vector<Change> *changes) {
+			return ApplyLocked(repo, odb, updates, packed, changes, baton);
+		}
+
+		bool Apply(Repository *repo, const vector<Update> &updates, bool packed,
+				Baton *baton, vector<Change> *changes) {
+			repo->lockRefs();
+			repo->lockObjects();
+			bool ok = ApplyLocked(repo->repo_, repo->odb_, updates, packed,
+					changes, baton);
+			repo->unlockObjects();
+			repo->packedRefs_->invalidate();
+			repo->unlockRefs();
+			return ok;
+		}
+	};
+}; // namespace gitteh
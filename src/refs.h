@@ -0,0 +1,168 @@
+#ifndef GITTEH_REFS_H
+#define GITTEH_REFS_H
+
+#include "gitteh.h"
+#include <vector>
+#include <map>
+#include <sys/types.h>
+
+namespace gitteh {
+	class Repository;
+
+	namespace Refs {
+		/**
+			One line (plus optional peel line) of a packed-refs file.
+		*/
+		struct PackedRef {
+			string name;
+			git_oid oid;
+			bool hasPeel;
+			git_oid peel;
+		};
+
+		typedef std::map<string, PackedRef> PackedRefMap;
+
+		/**
+			Read only view of a packed-refs file. The file is mmapped and
+			only the line offsets are kept, sorted by name (git writes it
+			sorted already, in which case nothing is moved), so lookups and
+			prefix listings are binary searches rather than a full reparse.
+			refresh() remaps the file if its inode, size or mtime changed.
+			Not thread safe, callers hold the refs lock.
+		*/
+		class PackedIndex {
+		public:
+			PackedIndex(const string &path);
+			~PackedIndex();
+
+			// Makes sure the view matches what's on disk. False if the file
+			// couldn't be read or is corrupted, a missing file is just empty.
+			bool refresh();
+			// Forces the next refresh() to remap the file.
+			void invalidate();
+
+			bool lookup(const string &name, PackedRef*) const;
+			// Appends every ref starting with prefix, in name order.
+			void list(const string &prefix, std::vector<PackedRef>*) const;
+			size_t size() const;
+			// Position of the first ref not sorting before name.
+			size_t lowerBound(const string &name) const;
+			void get(size_t i, PackedRef*) const;
+
+		private:
+			struct Entry {
+				const char *name;
+				size_t nameLen;
+				const char *oid;
+				const char *peel;
+			};
+
+			struct EntryLess;
+
+			bool load();
+			void unload();
+
+			string path_;
+			char *data_;
+			size_t size_;
+			bool loaded_;
+			dev_t dev_;
+			ino_t ino_;
+			time_t mtime_;
+			std::vector<Entry> entries_;
+		};
+
+		struct Update {
+			string name;
+			// A zero newOid deletes the ref.
+			git_oid newOid;
+			// If checkOld is set, ref must currently point at oldOid. A zero
+			// oldOid means the ref must not exist yet.
+			bool checkOld;
+			git_oid oldOid;
+		};
+
+		struct Change {
+			string name;
+			// Zero when the ref was created (oldOid) or deleted (newOid).
+			git_oid oldOid;
+			git_oid newOid;
+		};
+
+		// Reads all of packed-refs at path. A missing file is just empty.
+		bool ReadPacked(const string &path, PackedRefMap*);
+
+		/**
+			Applies all updates or none of them. Every affected ref is locked
+			(the same .lock files git uses) before any old value is checked or
+			anything is written. With `packed` set the new values go straight
+			into packed-refs (one file rename) and loose copies are removed,
+			otherwise loose files are written and only deletions touch
+			packed-refs. Takes the refs lock (and object lock) itself, and
+			invalidates the repository's PackedIndex. If changes is given it receives every
+			ref whose value actually changed.
+		*/
+		bool Apply(Repository*, const std::vector<Update>&, bool packed, Baton*,
+				std::vector<Change> *changes = NULL);
+
+		// Same, for a repository gitteh doesn't have open (the other end of
+		// a local push). The ref lock files still keep other writers out, but
+		// no repository locks are taken.
+		bool Apply(git_repository*, git_odb*, const std::vector<Update>&,
+				bool packed, Baton*, std::vector<Change> *changes = NULL);
+
+		struct ListOptions {
+			// Only refs whose name starts with prefix, must be under refs/.
+			string prefix;
+			// fnmatch() pattern (with FNM_PATHNAME) names must also match,
+			// if not empty.
+			string glob;
+			// Resolve symbolic refs to the oid they end up at.
+			bool resolve;
+			// Find what annotated tags point at.
+			bool peelTags;
+			// At most this many refs, 0 for no limit.
+			size_t limit;
+			// Only refs sorting after this name, for paging.
+			string after;
+		};
+
+		struct ListedRef {
+			string name;
+			bool direct;
+			// Object id for direct refs, target ref name for symbolic ones.
+			string target;
+			// Where the ref ends up pointing, set for direct refs and
+			// resolved symbolic ones.
+			bool hasOid;
+			git_oid oid;
+			// Set if oid is an annotated tag and peeling was asked for.
+			bool hasPeel;
+			git_oid peel;
+		};
+
+		/**
+			Lists refs in name order, merging loose refs with the packed
+			index in one pass (loose ones win). more is set if the listing
+			stopped because of limit. Takes the refs lock itself.
+		*/
+		bool List(Repository*, const ListOptions&, std::vector<ListedRef>*,
+				bool *more, Baton*);
+
+		struct PackResult {
+			unsigned int packed;
+			unsigned int pruned;
+		};
+
+		/**
+			Moves every loose direct ref into packed-refs, like
+			`git pack-refs --all`. With prune set the loose files are then
+			removed, each one only if it still holds the value that was packed
+			(checked while holding its .lock). Symbolic refs stay loose. Takes
+			the refs lock itself, and invalidates the PackedIndex.
+		*/
+		bool Pack(Repository*, bool prune, PackResult*, Baton*);
+	};
+}; // namespace gitteh
+
+#endif // GITTEH_REFS_H
@@ -0,0 +1,319 @@
+#include "refwatch.h"
+#include "repository.h"
+#include "refs.h"
+#include "scheduler.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+using std::map;
+using std::vector;
+
+namespace gitteh {
+	static Persistent<String> class_symbol;
+
+	class ScanBaton : public Baton {
+	public:
+		RefWatcher *watcher;
+		map<string, git_oid> refs;
+		vector<RefWatcher::WatchSpec> watches;
+
+		ScanBaton(RefWatcher *watcher) : Baton(), watcher(watcher) {
+			watcher->Ref();
+		}
+
+		~ScanBaton() {
+			watcher->Unref();
+		}
+	};
+
+	static void CollectDirs(const string &gitDir, const string &dir,
+			vector<string> *dirs) {
+		DIR *handle = opendir((gitDir + dir).c_str());
+		if(handle == NULL) return;
+		dirs->push_back(dir);
+
+		struct dirent *entry;
+		while((entry = readdir(handle)) != NULL) {
+			string name = entry->d_name;
+			if(name == "." || name == "..") continue;
+
+			struct stat st;
+			string child = dir + "/" + name;
+			if(lstat((gitDir + child).c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+				CollectDirs(gitDir, child, dirs);
+			}
+		}
+		closedir(handle);
+	}
+
+	Persistent<FunctionTemplate> RefWatcher::constructor_template;
+
+	RefWatcher::RefWatcher(Repository *repo, const string &prefix,
+			Handle<Value> callback, Handle<Value> ready) : ObjectWrap(),
+			repo_(repo), prefix_(prefix) {
+		callback_ = Persistent<Function>::New(Handle<Function>::Cast(callback));
+		if(ready->IsFunction()) {
+			ready_ = Persistent<Function>::New(Handle<Function>::Cast(ready));
+		}
+		gitDir_ = git_repository_path(repo->repo_);
+		initialized_ = false;
+		scanning_ = false;
+		dirty_ = false;
+		closed_ = false;
+		repo_->Ref();
+	}
+
+	RefWatcher::~RefWatcher() {
+		repo_->Unref();
+		callback_.Dispose();
+		callback_.Clear();
+		ready_.Dispose();
+		ready_.Clear();
+	}
+
+	void RefWatcher::Init(Handle<Object> target) {
+		HandleScope scope;
+
+		class_symbol = NODE_PSYMBOL("NativeRefWatcher");
+
+		Local<FunctionTemplate> t = FunctionTemplate::New(New);
+		constructor_template = Persistent<FunctionTemplate>::New(t);
+		constructor_template->SetClassName(class_symbol);
+		t->InstanceTemplate()->SetInternalFieldCount(1);
+
+		NODE_SET_PROTOTYPE_METHOD(t, "close", Close);
+
+		target->Set(class_symbol, constructor_template->GetFunction());
+	}
+
+	Handle<Value> RefWatcher::New(const Arguments &args) {
+		HandleScope scope;
+
+		if(args.Length() < 3 ||
+				!Repository::constructor_template->HasInstance(args[0])) {
+			return ThrowException(Exception::TypeError(
+					String::New("Expected a repository.")));
+		}
+		Repository *repo = ObjectWrap::Unwrap<Repository>(args[0]->ToObject());
+
+		RefWatcher *watcher = new RefWatcher(repo, CastFromJS<string>(args[1]),
+				args[2], args[3]);
+		watcher->Wrap(args.This());
+
+		// Stays alive while watching, whether JS holds on to it or not.
+		watcher->Ref();
+		watcher->scan();
+
+		return args.This();
+	}
+
+	Handle<Value> RefWatcher::Close(const Arguments &args) {
+		HandleScope scope;
+		ObjectWrap::Unwrap<RefWatcher>(args.This())->close();
+		return Undefined();
+	}
+
+	void RefWatcher::close() {
+		if(closed_) return;
+		closed_ = true;
+
+		for(map<string, Watch*>::iterator it = watches_.begin();
+				it != watches_.end(); ++it) {
+			uv_close((uv_handle_t*)&it->second->handle, WatchClosed);
+		}
+		watches_.clear();
+
+		Unref();
+	}
+
+	void RefWatcher::scan() {
+		if(scanning_) {
+			dirty_ = true;
+			return;
+		}
+		scanning_ = true;
+
+		ScanBaton *baton = new ScanBaton(this);
+		// Scans belong to the watcher, not to whatever call started the first
+		// one, so they don't inherit a timeout.
+		baton->deadline = 0;
+		Scheduler::Queue(baton, AsyncScan, AsyncAfterScan);
+	}
+
+	/**
+		Every directory under the prefix gets watched. Its parents are watched
+		too, but only for the next path component, so that the prefix
+		directory appearing (or being replaced) is noticed.
+	*/
+	void RefWatcher::CollectWatches(const string &gitDir, const string &prefix,
+			vector<WatchSpec> *watches) {
+		WatchSpec packed;
+		packed.filter = "packed-refs";
+		watches->push_back(packed);
+
+		string dir = prefix.substr(0, prefix.rfind('/'));
+		for(size_t slash = dir.find('/'); slash != string::npos;
+				slash = dir.find('/', slash + 1)) {
+			WatchSpec parent;
+			parent.dir = dir.substr(0, slash);
+			size_t end = dir.find('/', slash + 1);
+			parent.filter = dir.substr(slash + 1,
+					end == string::npos ? string::npos : end - slash - 1);
+			watches->push_back(parent);
+		}
+
+		vector<string> dirs;
+		CollectDirs(gitDir, dir, &dirs);
+		for(size_t i = 0; i < dirs.size(); i++) {
+			WatchSpec spec;
+			spec.dir = dirs[i];
+			watches->push_back(spec);
+		}
+	}
+
+	void RefWatcher::updateWatches(const vector<WatchSpec> &specs) {
+		map<string, Watch*> watches;
+		for(size_t i = 0; i < specs.size(); i++) {
+			const WatchSpec &spec = specs[i];
+			map<string, Watch*>::iterator it = watches_.find(spec.dir);
+			if(it != watches_.end() && it->second->spec.filter == spec.filter) {
+				watches[spec.dir] = it->second;
+				watches_.erase(it);
+				continue;
+			}
+
+			Watch *watch = new Watch;
+			watch->watcher = this;
+			watch->spec = spec;
+			watch->handle.data = watch;
+			if(uv_fs_event_init(uv_default_loop(), &watch->handle,
+					(gitDir_ + spec.dir).c_str(), FsEvent, 0) != 0) {
+				// Gone again already, the next scan will sort it out.
+				delete watch;
+				continue;
+			}
+			watches[spec.dir] = watch;
+		}
+
+		// Whatever is left wasn't wanted anymore.
+		for(map<string, Watch*>::iterator it = watches_.begin();
+				it != watches_.end(); ++it) {
+			uv_close((uv_handle_t*)&it->second->handle, WatchClosed);
+		}
+		watches_.swap(watches);
+	}
+
+	void RefWatcher::fireChanges(const map<string, git_oid> &refs) {
+		HandleScope scope;
+
+		map<string, git_oid>::const_iterator before = refs_.begin();
+		map<string, git_oid>::const_iterator after = refs.begin();
+		while(!closed_ && (before != refs_.end() || after != refs.end())) {
+			Handle<Value> argv[] = { Null(), Null(), Null() };
+
+			if(after == refs.end() ||
+					(before != refs_.end() && before->first < after->first)) {
+				argv[0] = CastToJS(before->first);
+				argv[1] = CastToJS(before->second);
+				++before;
+			}
+			else if(before == refs_.end() || after->first < before->first) {
+				argv[0] = CastToJS(after->first);
+				argv[2] = CastToJS(after->second);
+				++after;
+			}
+			else {
+				bool same = !git_oid_cmp(&before->second, &after->second);
+				argv[0] = CastToJS(after->first);
+				argv[1] = CastToJS(before->second);
+				argv[2] = CastToJS(after->second);
+				++before;
+				++after;
+				if(same) continue;
+			}
+
+			FireCallback(callback_, 3, argv);
+		}
+	}
+
+	void RefWatcher::FsEvent(uv_fs_event_t *handle, const char *filename,
+			int events, int status) {
+		Watch *watch = static_cast<Watch*>(handle->data);
+		RefWatcher *watcher = watch->watcher;
+		if(watcher->closed_) return;
+
+		if(filename != NULL) {
+			string name = filename;
+			if(!watch->spec.filter.empty() && name != watch->spec.filter) return;
+			// Lock files come and go around every update, the rename of the
+			// lock into place is what we're after.
+			if(name.size() >= 5 && !name.compare(name.size() - 5, 5, ".lock")) {
+				return;
+			}
+		}
+
+		watcher->scan();
+	}
+
+	void RefWatcher::WatchClosed(uv_handle_t *handle) {
+		delete static_cast<Watch*>(((uv_fs_event_t*)handle)->data);
+	}
+
+	void RefWatcher::AsyncScan(uv_work_t *req) {
+		ScanBaton *baton = GetBaton<ScanBaton>(req);
+		RefWatcher *watcher = baton->watcher;
+
+		// Directories first. One created after this is still noticed, its
+		// parent is already being watched, and gets picked up next scan.
+		CollectWatches(watcher->gitDir_, watcher->prefix_, &baton->watches);
+
+		Refs::ListOptions options;
+		options.prefix = watcher->prefix_;
+		options.resolve = true;
+		options.peelTags = false;
+		options.limit = 0;
+
+		vector<Refs::ListedRef> refs;
+		bool more;
+		if(!Refs::List(watcher->repo_, options, &refs, &more, baton)) return;
+
+		for(size_t i = 0; i < refs.size(); i++) {
+			if(refs[i].hasOid) baton->refs[refs[i].name] = refs[i].oid;
+		}
+	}
+
+	void RefWatcher::AsyncAfterScan(uv_work_t *req) {
+		HandleScope scope;
+		ScanBaton *baton = GetBaton<ScanBaton>(req);
+		RefWatcher *watcher = baton->watcher;
+		watcher->scanning_ = false;
+
+		// A failed scan (say a ref being written by something that doesn't
+		// lock) is just skipped, the next event will scan again.
+		if(!watcher->closed_ && !baton->isErrored()) {
+			watcher->updateWatches(baton->watches);
+			if(watcher->initialized_) {
+				watcher->fireChanges(baton->refs);
+			}
+			watcher->refs_.swap(baton->refs);
+			watcher->initialized_ = true;
+		}
+
+		if(!watcher->closed_ && watcher->dirty_) {
+			watcher->dirty_ = false;
+			watcher->scan();
+		}
+
+		// The baton still holds the watcher, should ready close it.
+		if(!watcher->closed_ && watcher->initialized_ &&
+				!watcher->ready_.IsEmpty()) {
+			Persistent<Function> ready = watcher->ready_;
+			watcher->ready_.Clear();
+			FireCallback(ready, 0, NULL);
+			ready.Dispose();
+		}
+
+		delete baton;
+	}
+}; // namespace gitteh
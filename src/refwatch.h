@@ -0,0 +1,78 @@
+#ifndef GITTEH_REFWATCH_H
+#define GITTEH_REFWATCH_H
+
+#include "gitteh.h"
+#include <map>
+#include <vector>
+
+namespace gitteh {
+	class Repository;
+	class ScanBaton;
+
+	/**
+		Watches the refs under a prefix for changes, and calls back with
+		(name, oldOid, newOid) for each ref that was created, moved or deleted.
+		libuv's fs events (inotify on Linux) are set up on every directory
+		under the prefix, plus packed-refs. Any number of events arriving
+		while a scan is running are coalesced into a single rescan, which
+		lists the refs off the main thread and diffs against the last result.
+		The optional ready callback fires once the first scan, the one every
+		later change is diffed against, is in. Keeps the event loop alive
+		until closed.
+	*/
+	class RefWatcher : public ObjectWrap {
+	public:
+		friend class ScanBaton;
+
+		static Persistent<FunctionTemplate> constructor_template;
+		static void Init(Handle<Object>);
+
+	protected:
+		static Handle<Value> New(const Arguments&);
+		static Handle<Value> Close(const Arguments&);
+
+	private:
+		struct WatchSpec {
+			// Relative to the git directory.
+			string dir;
+			// If set only changes to this entry of dir are interesting.
+			string filter;
+		};
+
+		struct Watch {
+			uv_fs_event_t handle;
+			RefWatcher *watcher;
+			WatchSpec spec;
+		};
+
+		RefWatcher(Repository*, const string &prefix, Handle<Value> callback,
+				Handle<Value> ready);
+		~RefWatcher();
+
+		void scan();
+		void close();
+		void updateWatches(const std::vector<WatchSpec>&);
+		void fireChanges(const std::map<string, git_oid>&);
+
+		static void CollectWatches(const string &gitDir, const string &prefix,
+				std::vector<WatchSpec>*);
+		static void FsEvent(uv_fs_event_t*, const char*, int, int);
+		static void WatchClosed(uv_handle_t*);
+		static void AsyncScan(uv_work_t*);
+		static void AsyncAfterScan(uv_work_t*);
+
+		Repository *repo_;
+		string gitDir_;
+		string prefix_;
+		Persistent<Function> callback_;
+		Persistent<Function> ready_;
+		std::map<string, Watch*> watches_;
+		std::map<string, git_oid> refs_;
+		bool initialized_;
+		bool scanning_;
+		bool dirty_;
+		bool closed_;
+	};
+}; // namespace gitteh
+
+#endif // GITTEH_REFWATCH_H
@@ -1,7 +1,15 @@
 #include "remote.h"
+#include "repository.h"
+#include "progress.h"
+#include "transfer.h"
+#include "refs.h"
+#include "packer.h"
+#include "scheduler.h"
+#include <unistd.h>
 
 using std::map;
 using std::pair;
+using std::vector;
 
 namespace gitteh {
 	static Persistent<String> class_symbol;
@@ -9,7 +17,6 @@ namespace gitteh {
 	static Persistent<String> url_symbol;
 	static Persistent<String> fetchspec_symbol;
 	static Persistent<String> pushspec_symbol;
-	static Persistent<String> stats_symbol;
 
 	static Persistent<String> refspec_src_symbol;
 	static Persistent<String> refspec_dst_symbol;
@@ -17,6 +24,32 @@ namespace gitteh {
 	static Persistent<String> stats_bytes_symbol;
 	static Persistent<String> stats_total_symbol;
 	static Persistent<String> stats_done_symbol;
+	static Persistent<String> stats_rate_symbol;
+	static Persistent<String> stats_elapsed_symbol;
+
+	static Persistent<String> change_old_symbol;
+	static Persistent<String> change_new_symbol;
+
+	static Persistent<String> refs_names_symbol;
+	static Persistent<String> refs_oids_symbol;
+
+	static Persistent<String> pack_objects_symbol;
+	static Persistent<String> pack_reused_symbol;
+	static Persistent<String> pack_deltas_symbol;
+
+	// Fields reported to the download progress callback, in argument order.
+	enum {
+		DOWNLOAD_BYTES,
+		DOWNLOAD_TOTAL,
+		DOWNLOAD_DONE,
+		DOWNLOAD_RATE,
+		DOWNLOAD_FIELDS
+	};
+
+	// How often (ms) the main thread samples the download counters, and at
+	// most how often the progress callback runs.
+	static const int DOWNLOAD_SAMPLE_INTERVAL = 50;
+	static const int DOWNLOAD_PROGRESS_INTERVAL = 250;
 
 	class RemoteBaton : public Baton {
 	public:
@@ -33,36 +66,155 @@ namespace gitteh {
 
 	class UpdateTipsBaton : public RemoteBaton {
 	public:
+		vector<Refs::Change> changes;
+
 		UpdateTipsBaton(Remote *remote) : RemoteBaton(remote) { }
 	};
 
+	// git_remote_update_tips has no payload for its callback, so calls are
+	// serialized and the callback finds the baton to report to here.
+	static gitteh_lock updateTipsLock;
+	static UpdateTipsBaton *updatingTips = NULL;
+
+	static int SaveTip(const char *name, const git_oid *oldOid,
+			const git_oid *newOid) {
+		Refs::Change change;
+		change.name = name;
+		change.oldOid = *oldOid;
+		change.newOid = *newOid;
+		updatingTips->changes.push_back(change);
+		return GIT_OK;
+	}
+
+	class PushBaton : public RemoteBaton {
+	public:
+		// One entry per refspec. An empty src deletes dst, a src ending in
+		// '*' pushes every ref under it (and dst then ends in '*' too).
+		vector<string> srcs;
+		vector<string> dsts;
+		vector<bool> forces;
+		int threads;
+		Progress *progress;
+		Packer::Result result;
+		vector<Refs::Change> changes;
+
+		PushBaton(Remote *remote) : RemoteBaton(remote), threads(0),
+				progress(NULL) {
+			memset(&result, 0, sizeof(Packer::Result));
+		}
+	};
+
 	class ConnectBaton : public RemoteBaton {
 	public:
 		int direction;
-		map<string, git_oid> refs;
+		// Only advertised refs matching one of these are kept, see
+		// MatchesPattern. Everything is kept if there are none.
+		vector<string> patterns;
+		bool binary;
+		vector<pair<string, git_oid> > refs;
+
+		// What HEAD points at and the first ref (filtered out or not) that
+		// points there too, for guessing the branch HEAD is on.
+		bool hasHead;
+		git_oid head;
+		string headRef;
 
 		ConnectBaton(Remote *remote, int direction) :
-				RemoteBaton(remote), direction(direction) { }
+				RemoteBaton(remote), direction(direction), binary(false),
+				hasHead(false) { }
 	};
 
 	class DownloadBaton : public RemoteBaton {
 	public:
-		git_off_t *bytes;
-		git_indexer_stats *stats;
-		DownloadBaton(Remote *remote) :
-				RemoteBaton(remote) { }
+		// Bumped by the worker (or libgit2 on it) as the download goes, only
+		// ever read with ATOMIC_READ while it runs.
+		git_off_t bytes;
+		git_indexer_stats stats;
+		// Guarded by lock, zero until the worker starts.
+		uint64_t start;
+		uint64_t elapsed;
+
+		// Threads packing and indexing a local download.
+		int threads;
+		Progress *progress;
+		// Main thread, samples the counters into progress.
+		uv_timer_t timer;
+		gitteh_lock lock;
+
+		DownloadBaton(Remote *remote) : RemoteBaton(remote), bytes(0),
+				start(0), elapsed(0), threads(0), progress(NULL) {
+			memset(&stats, 0, sizeof(git_indexer_stats));
+			CREATE_MUTEX(lock);
+		}
+
+		~DownloadBaton() {
+			DESTROY_MUTEX(lock);
+		}
+
+		double rate() {
+			LOCK_MUTEX(lock);
+			uint64_t start = this->start;
+			uint64_t elapsed = this->elapsed;
+			UNLOCK_MUTEX(lock);
+			if(start == 0) return 0;
+			uint64_t ns = (elapsed ? elapsed : uv_hrtime() - start);
+			return ns ? ATOMIC_READ(&bytes) * 1e9 / ns : 0;
+		}
 	};
 
+	// A pattern ending in '*' or '/' matches everything under that prefix
+	// (so refs/heads/* covers nested branch names too, like a refspec does),
+	// anything else has to match the whole name.
+	static bool MatchesPattern(const vector<string> &patterns,
+			const string &name) {
+		if(patterns.empty()) return true;
+		for(size_t i = 0; i < patterns.size(); i++) {
+			const string &pattern = patterns[i];
+			if(pattern.empty()) continue;
+			char last = pattern[pattern.size() - 1];
+			if(last == '*' || last == '/') {
+				size_t len = pattern.size() - (last == '*' ? 1 : 0);
+				if(!name.compare(0, len, pattern, 0, len)) return true;
+			}
+			else if(name == pattern) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static void SaveHead(ConnectBaton *baton, const string &name,
+			const git_oid &oid) {
+		if(name == "HEAD") {
+			baton->hasHead = true;
+			baton->head = oid;
+		}
+		else if(baton->hasHead && baton->headRef.empty() &&
+				!git_oid_cmp(&oid, &baton->head)) {
+			baton->headRef = name;
+		}
+
+		if(MatchesPattern(baton->patterns, name)) {
+			baton->refs.push_back(pair<string, git_oid>(name, oid));
+		}
+	}
+
 	static int SaveRemoteRef(git_remote_head *head, void *payload) {
-		ConnectBaton *baton = static_cast<ConnectBaton*>(payload);
-		baton->refs.insert(pair<string, git_oid>(string(head->name), head->oid));
+		SaveHead(static_cast<ConnectBaton*>(payload), head->name, head->oid);
 		return GIT_OK;
 	}
 
 	Persistent<FunctionTemplate> Remote::constructor_template;
 
-	Remote::Remote(git_remote *remote) : ObjectWrap() {
+	Remote::Remote(git_remote *remote, Repository *repo) : ObjectWrap() {
 		remote_ = remote;
+		repo_ = repo;
+		repo_->Ref();
+
+		string path;
+		if(Transfer::LocalPath(git_remote_url(remote), &path)) {
+			localPath_ = path;
+		}
 	}
 
 	Remote::~Remote() {
@@ -70,6 +222,7 @@ namespace gitteh {
 			git_remote_free(remote_);
 			remote_ = NULL;
 		}
+		repo_->Unref();
 	}
 
 	void Remote::Init(Handle<Object> target) {
@@ -80,7 +233,6 @@ namespace gitteh {
 		url_symbol 			= NODE_PSYMBOL("url");
 		fetchspec_symbol 	= NODE_PSYMBOL("fetchSpec");
 		pushspec_symbol 	= NODE_PSYMBOL("pushSpec");
-		stats_symbol 		= NODE_PSYMBOL("stats");
 
 		refspec_src_symbol 	= NODE_PSYMBOL("src");
 		refspec_dst_symbol 	= NODE_PSYMBOL("dst");
@@ -88,6 +240,20 @@ namespace gitteh {
 		stats_bytes_symbol	= NODE_PSYMBOL("bytes");
 		stats_total_symbol	= NODE_PSYMBOL("total");
 		stats_done_symbol	= NODE_PSYMBOL("done");
+		stats_rate_symbol	= NODE_PSYMBOL("rate");
+		stats_elapsed_symbol	= NODE_PSYMBOL("elapsed");
+
+		change_old_symbol	= NODE_PSYMBOL("oldOid");
+		change_new_symbol	= NODE_PSYMBOL("newOid");
+
+		refs_names_symbol	= NODE_PSYMBOL("names");
+		refs_oids_symbol	= NODE_PSYMBOL("oids");
+
+		pack_objects_symbol	= NODE_PSYMBOL("objects");
+		pack_reused_symbol	= NODE_PSYMBOL("reused");
+		pack_deltas_symbol	= NODE_PSYMBOL("deltas");
+
+		CREATE_MUTEX(updateTipsLock);
 
 		Local<FunctionTemplate> t = FunctionTemplate::New(New);
 		constructor_template = Persistent<FunctionTemplate>::New(t);
@@ -97,6 +263,7 @@ namespace gitteh {
 		NODE_SET_PROTOTYPE_METHOD(t, "updateTips", UpdateTips);
 		NODE_SET_PROTOTYPE_METHOD(t, "connect", Connect);
 		NODE_SET_PROTOTYPE_METHOD(t, "download", Download);
+		NODE_SET_PROTOTYPE_METHOD(t, "push", Push);
 
 		target->Set(class_symbol, constructor_template->GetFunction());
 	}
@@ -104,10 +271,12 @@ namespace gitteh {
 	Handle<Value> Remote::New(const Arguments& args) {
 		HandleScope scope;
 		REQ_EXT_ARG(0, remoteArg);
+		REQ_EXT_ARG(1, repoArg);
 		Handle<Object> me = args.This();
 
 		git_remote *remote = static_cast<git_remote*>(remoteArg->Value());
-		Remote *remoteObj = new Remote(remote);
+		Repository *repo = static_cast<Repository*>(repoArg->Value());
+		Remote *remoteObj = new Remote(remote, repo);
 		remoteObj->Wrap(me);
 
 		me->Set(name_symbol, CastToJS(git_remote_name(remote)));
@@ -123,16 +292,60 @@ namespace gitteh {
 		Remote *remote = ObjectWrap::Unwrap<Remote>(args.This());
 		UpdateTipsBaton *baton = new UpdateTipsBaton(remote);
 		baton->setCallback(args[0]);
-		uv_queue_work(uv_default_loop(), &baton->req, AsyncUpdateTips, 
-				AsyncAfterUpdateTips);
+		Scheduler::Queue(baton, AsyncUpdateTips, AsyncAfterUpdateTips);
 		return Undefined();
 	}
 
 	void Remote::AsyncUpdateTips(uv_work_t *req) {
 		UpdateTipsBaton *baton = GetBaton<UpdateTipsBaton>(req);
-		// TODO: use the callback to get changed refs once fn accepts a payload
-		AsyncLibCall(git_remote_update_tips(baton->remote_->remote_, NULL),
-				baton);
+		Remote *remote = baton->remote_;
+
+		if(!remote->localPath_.empty()) {
+			vector<Refs::Update> updates;
+			for(size_t i = 0; i < remote->localTips_.size(); i++) {
+				Refs::Update update;
+				update.name = remote->localTips_[i].first;
+				update.newOid = remote->localTips_[i].second;
+				update.checkOld = false;
+				updates.push_back(update);
+			}
+			Refs::Apply(remote->repo_, updates, false, baton, &baton->changes);
+			return;
+		}
+
+		LOCK_MUTEX(updateTipsLock);
+		remote->repo_->lockRefs();
+		updatingTips = baton;
+		AsyncLibCall(git_remote_update_tips(remote->remote_, SaveTip), baton);
+		updatingTips = NULL;
+		remote->repo_->unlockRefs();
+		UNLOCK_MUTEX(updateTipsLock);
+	}
+
+	static bool IsZero(const git_oid &oid) {
+		for(int i = 0; i < GIT_OID_RAWSZ; i++) {
+			if(oid.id[i]) return false;
+		}
+		return true;
+	}
+
+	static Handle<Value> OidOrNull(const git_oid &oid) {
+		if(IsZero(oid)) return Null();
+		return CastToJS(oid);
+	}
+
+	static Handle<Array> ChangesToJS(const vector<Refs::Change> &changes) {
+		HandleScope scope;
+		Handle<Array> array = Array::New(changes.size());
+		for(size_t i = 0; i < changes.size(); i++) {
+			const Refs::Change &change = changes[i];
+			Handle<Object> o = Object::New();
+			o->Set(name_symbol, CastToJS(change.name));
+			o->Set(change_old_symbol, OidOrNull(change.oldOid));
+			o->Set(change_new_symbol, OidOrNull(change.newOid));
+			array->Set(i, o);
+		}
+		return scope.Close(array);
 	}
 
 	void Remote::AsyncAfterUpdateTips(uv_work_t *req) {
@@ -144,8 +357,8 @@ namespace gitteh {
 			FireCallback(baton->callback, 1, argv);
 		}
 		else {
-			Handle<Value> argv[] = { Undefined() };
-			FireCallback(baton->callback, 1, argv);
+			Handle<Value> argv[] = { Undefined(), ChangesToJS(baton->changes) };
+			FireCallback(baton->callback, 2, argv);
 		}
 
 		delete baton;
@@ -155,14 +368,34 @@ namespace gitteh {
 		HandleScope scope;
 		Remote *remote = ObjectWrap::Unwrap<Remote>(args.This());
 		ConnectBaton *baton = new ConnectBaton(remote, CastFromJS<int>(args[0]));
-		baton->setCallback(args[1]);
-		uv_queue_work(uv_default_loop(), &baton->req, AsyncConnect, 
-				AsyncAfterConnect);
+		baton->patterns = CastFromJS<vector<string> >(args[1]);
+		baton->binary = CastFromJS<bool>(args[2]);
+		baton->setCallback(args[3]);
+		Scheduler::Queue(baton, AsyncConnect, AsyncAfterConnect);
 		return Undefined();
 	}
 
 	void Remote::AsyncConnect(uv_work_t *req) {
 		ConnectBaton *baton = GetBaton<ConnectBaton>(req);
+		Remote *remote = baton->remote_;
+
+		// Both directions see the same refs.
+		if(!remote->localPath_.empty()) {
+			git_repository *repo;
+			map<string, git_oid> heads;
+			if(AsyncLibCall(git_repository_open(&repo, remote->localPath_.c_str()),
+					baton)) {
+				Transfer::ListHeads(repo, &heads, baton);
+				git_repository_free(repo);
+			}
+			// HEAD sorts before refs/, just like it's advertised first.
+			for(map<string, git_oid>::iterator it = heads.begin();
+					it != heads.end(); ++it) {
+				SaveHead(baton, it->first, it->second);
+			}
+			return;
+		}
+
 		if(AsyncLibCall(git_remote_connect(baton->remote_->remote_,
 				baton->direction), baton)) {
 			git_remote_ls(baton->remote_->remote_, SaveRemoteRef, baton);
@@ -178,8 +411,34 @@ namespace gitteh {
 			FireCallback(baton->callback, 1, argv);
 		}
 		else {
-			Handle<Value> argv[] = { Undefined(), CastToJS(baton->refs) };
-			FireCallback(baton->callback, 2, argv);
+			size_t count = baton->refs.size();
+			Handle<Object> refs = Object::New();
+			if(baton->binary) {
+				// Names in one array, oids packed back to back in one buffer.
+				Handle<Array> names = Array::New(count);
+				Buffer *buffer = Buffer::New(count * GIT_OID_RAWSZ);
+				char *data = Buffer::Data(buffer->handle_);
+				for(size_t i = 0; i < count; i++) {
+					names->Set(i, CastToJS(baton->refs[i].first));
+					memcpy(data + i * GIT_OID_RAWSZ, baton->refs[i].second.id,
+							GIT_OID_RAWSZ);
+				}
+				refs->Set(refs_names_symbol, names);
+				refs->Set(refs_oids_symbol,
+						MakeFastBuffer(buffer, count * GIT_OID_RAWSZ));
+			}
+			else {
+				for(size_t i = 0; i < count; i++) {
+					refs->Set(CastToJS(baton->refs[i].first),
+							CastToJS(baton->refs[i].second));
+				}
+			}
+
+			Handle<Value> headRef = Null();
+			if(!baton->headRef.empty()) headRef = CastToJS(baton->headRef);
+
+			Handle<Value> argv[] = { Undefined(), refs, headRef };
+			FireCallback(baton->callback, 3, argv);
 		}
 
 		delete baton;
@@ -189,54 +448,374 @@ namespace gitteh {
 		HandleScope scope;
 		Remote *remote = ObjectWrap::Unwrap<Remote>(args.This());
 		DownloadBaton *baton = new DownloadBaton(remote);
-		baton->setCallback(args[0]);
-		baton->bytes = &remote->downloadBytes_;
-		baton->stats = &remote->indexerStats_;
+		baton->threads = CastFromJS<int>(args[0]);
+		if(args[1]->IsFunction()) {
+			baton->progress = new Progress(args[1], DOWNLOAD_FIELDS,
+					DOWNLOAD_PROGRESS_INTERVAL);
+			uv_timer_init(uv_default_loop(), &baton->timer);
+			baton->timer.data = baton;
+			uv_timer_start(&baton->timer, SampleDownload,
+					DOWNLOAD_SAMPLE_INTERVAL, DOWNLOAD_SAMPLE_INTERVAL);
+		}
+		baton->setCallback(args[2]);
 
-		// Re-initialize stat counters.
-		remote->downloadBytes_ = 0;
-		memset(&remote->indexerStats_, 0, sizeof(git_indexer_stats));
+		Scheduler::Queue(baton, AsyncDownload, AsyncAfterDownload);
+		return Undefined();
+	}
+
+	/**
+		libgit2 0.17's git_remote_download has no progress callback, it just
+		keeps bumping the counters it was handed (and our local copy does the
+		same, with ATOMIC_ADD). So a timer on the main thread reads them, with
+		atomic loads, and hands them to Progress, which takes it from there.
+		No thread of our own sits polling, and a read is never torn.
+	*/
+	static void ReportDownload(DownloadBaton *baton) {
+		Progress *progress = baton->progress;
+		progress->set(DOWNLOAD_BYTES, ATOMIC_READ(&baton->bytes));
+		progress->set(DOWNLOAD_TOTAL, ATOMIC_READ(&baton->stats.total));
+		progress->set(DOWNLOAD_DONE, ATOMIC_READ(&baton->stats.processed));
+		progress->set(DOWNLOAD_RATE, baton->rate());
+		progress->notify();
+	}
 
-		// Setup download stats accessor.
-		remote->handle_->SetAccessor(stats_symbol, GetStats);
+	void Remote::SampleDownload(uv_timer_t *handle, int status) {
+		ReportDownload(static_cast<DownloadBaton*>(handle->data));
+	}
 
-		uv_queue_work(uv_default_loop(), &baton->req, AsyncDownload, 
-				AsyncAfterDownload);
-		return Undefined();
+	void Remote::FreeDownload(uv_handle_t *handle) {
+		delete static_cast<DownloadBaton*>(handle->data);
+	}
+
+	/**
+		Copies what the fetchspec wants from a repository on this machine:
+		the Packer writes what our refs don't already reach into one pack
+		(keeping the deltas src has) and the Indexer installs it, both on
+		baton->threads threads. The refs are kept for updateTips.
+	*/
+	bool Remote::DownloadLocal(DownloadBaton *baton,
+			vector<pair<string, git_oid> > *tips) {
+		Remote *remote = baton->remote_;
+		git_repository *src;
+		if(!AsyncLibCall(git_repository_open(&src, remote->localPath_.c_str()),
+				baton)) {
+			return false;
+		}
+		map<string, git_oid> heads;
+		bool ok = Transfer::ListHeads(src, &heads, baton);
+
+		const git_refspec *spec = git_remote_fetchspec(remote->remote_);
+		Packer::Options options;
+		options.threads = baton->threads;
+		options.boundary = NULL;
+		for(map<string, git_oid>::iterator it = heads.begin();
+				ok && spec != NULL && it != heads.end(); ++it) {
+			if(it->first == "HEAD" ||
+					!git_refspec_src_matches(spec, it->first.c_str())) {
+				continue;
+			}
+			char name[1024];
+			if(!AsyncLibCall(git_refspec_transform(name, sizeof(name), spec,
+					it->first.c_str()), baton)) {
+				ok = false;
+				break;
+			}
+			tips->push_back(pair<string, git_oid>(name, it->second));
+			options.wants.push_back(it->second);
+		}
+
+		Repository *repo = remote->repo_;
+		if(ok) {
+			map<string, git_oid> local;
+			repo->lockRefs();
+			ok = Transfer::ListHeads(repo->repo_, &local, baton);
+			repo->unlockRefs();
+			for(map<string, git_oid>::iterator it = local.begin();
+					it != local.end(); ++it) {
+				options.haves.push_back(it->second);
+			}
+
+			// Tips we already have need nothing sent, and if that's all of
+			// them no (empty) pack is written.
+			vector<git_oid> wants;
+			repo->lockObjects();
+			for(size_t i = 0; i < options.wants.size(); i++) {
+				if(!git_odb_exists(repo->odb_, &options.wants[i])) {
+					wants.push_back(options.wants[i]);
+				}
+			}
+			repo->unlockObjects();
+			options.wants.swap(wants);
+		}
+
+		string packDir = string(git_repository_path(repo->repo_)) + "objects/pack";
+		Packer::Result result;
+		if(ok && !options.wants.empty()) {
+			ok = Transfer::InstallPacked(src, options, packDir, &baton->bytes,
+					&result, baton);
+			if(ok) {
+				repo->lockObjects();
+				if(!repo->reloadObjects()) {
+					baton->setError(giterr_last());
+					ok = false;
+				}
+				repo->unlockObjects();
+			}
+			if(ok) {
+				ATOMIC_ADD(&baton->stats.total, result.objects);
+				ATOMIC_ADD(&baton->stats.processed, result.objects);
+			}
+		}
+
+		git_repository_free(src);
+		return ok;
 	}
 
 	void Remote::AsyncDownload(uv_work_t *req) {
 		DownloadBaton *baton = GetBaton<DownloadBaton>(req);
-		AsyncLibCall(git_remote_download(baton->remote_->remote_,
-				baton->bytes, baton->stats), baton);
+		Remote *remote = baton->remote_;
+		LOCK_MUTEX(baton->lock);
+		baton->start = uv_hrtime();
+		UNLOCK_MUTEX(baton->lock);
+
+		if(!remote->localPath_.empty()) {
+			vector<pair<string, git_oid> > tips;
+			if(DownloadLocal(baton, &tips)) {
+				remote->localTips_.swap(tips);
+			}
+		}
+		else {
+			AsyncLibCall(git_remote_download(remote->remote_, &baton->bytes,
+					&baton->stats), baton);
+		}
+		LOCK_MUTEX(baton->lock);
+		baton->elapsed = uv_hrtime() - baton->start;
+		UNLOCK_MUTEX(baton->lock);
 	}
 
 	void Remote::AsyncAfterDownload(uv_work_t *req) {
 		HandleScope scope;
 		DownloadBaton *baton = GetBaton<DownloadBaton>(req);
 
-		baton->remote_->handle_->Delete(stats_symbol);
+		if(baton->progress) {
+			// Final values, close() fires the callback one last time.
+			uv_timer_stop(&baton->timer);
+			ReportDownload(baton);
+			baton->progress->close();
+		}
 
 		if(baton->isErrored()) {
 			Handle<Value> argv[] = { baton->createV8Error() };
 			FireCallback(baton->callback, 1, argv);
 		}
 		else {
-			Handle<Value> argv[] = { Undefined() };
-			FireCallback(baton->callback, 1, argv);
+			Handle<Object> summary = Object::New();
+			summary->Set(stats_bytes_symbol, CastToJS((double)baton->bytes));
+			summary->Set(stats_total_symbol, CastToJS(baton->stats.total));
+			summary->Set(stats_done_symbol, CastToJS(baton->stats.processed));
+			summary->Set(stats_rate_symbol, CastToJS(baton->rate()));
+			summary->Set(stats_elapsed_symbol,
+					CastToJS(baton->elapsed / 1e6));
+
+			Handle<Value> argv[] = { Undefined(), summary };
+			FireCallback(baton->callback, 2, argv);
 		}
 
-		delete baton;
+		// The timer goes first, it still points at the baton.
+		if(baton->progress) {
+			uv_close((uv_handle_t*)&baton->timer, FreeDownload);
+		}
+		else {
+			delete baton;
+		}
 	}
 
-	Handle<Value> Remote::GetStats(Local<String> property, const AccessorInfo &info) {
+	Handle<Value> Remote::Push(const Arguments &args) {
 		HandleScope scope;
-		Remote *remote = ObjectWrap::Unwrap<Remote>(info.This());
-		Handle<Object> o = Object::New();
-		o->Set(stats_bytes_symbol, CastToJS(remote->downloadBytes_));
-		o->Set(stats_total_symbol, CastToJS(remote->indexerStats_.total));
-		o->Set(stats_done_symbol, CastToJS(remote->indexerStats_.processed));
-		return scope.Close(o);
+		Remote *remote = ObjectWrap::Unwrap<Remote>(args.This());
+		PushBaton *baton = new PushBaton(remote);
+		baton->srcs = CastFromJS<vector<string> >(args[0]);
+		baton->dsts = CastFromJS<vector<string> >(args[1]);
+		baton->forces = CastFromJS<vector<bool> >(args[2]);
+		baton->threads = CastFromJS<int>(args[3]);
+		if(args[4]->IsFunction()) {
+			baton->progress = new Progress(args[4], Packer::PROGRESS_FIELDS, 100);
+		}
+		baton->setCallback(args[5]);
+
+		Scheduler::Queue(baton, AsyncPush, AsyncAfterPush);
+		return Undefined();
+	}
+
+	/**
+		Works out what a push changes on the remote: the refspecs resolved
+		against our refs, each paired with the remote's current value. Unless
+		forced an update has to be a fast-forward, checked against our own
+		history, so moving a ref off a remote commit we don't have is refused.
+		Updates that wouldn't change anything are left out.
+	*/
+	bool Remote::PushUpdates(PushBaton *baton,
+			const map<string, git_oid> &remoteRefs,
+			vector<Refs::Update> *updates) {
+		Repository *repo = baton->remote_->repo_;
+		map<string, git_oid> local;
+		repo->lockRefs();
+		bool ok = Transfer::ListHeads(repo->repo_, &local, baton);
+		repo->unlockRefs();
+		if(!ok) return false;
+
+		git_oid zero;
+		memset(&zero, 0, sizeof(git_oid));
+		vector<pair<string, git_oid> > targets;
+		vector<bool> forced;
+		for(size_t i = 0; i < baton->srcs.size(); i++) {
+			const string &src = baton->srcs[i];
+			const string &dst = baton->dsts[i];
+			if(src.empty()) {
+				targets.push_back(pair<string, git_oid>(dst, zero));
+				forced.push_back(baton->forces[i]);
+			}
+			else if(src[src.size() - 1] == '*') {
+				string srcRoot = src.substr(0, src.size() - 1);
+				string dstRoot = dst.substr(0, dst.size() - 1);
+				for(map<string, git_oid>::iterator it = local.begin();
+						it != local.end(); ++it) {
+					if(it->first == "HEAD" || it->first.size() <= srcRoot.size() ||
+							it->first.compare(0, srcRoot.size(), srcRoot)) {
+						continue;
+					}
+					targets.push_back(pair<string, git_oid>(
+							dstRoot + it->first.substr(srcRoot.size()), it->second));
+					forced.push_back(baton->forces[i]);
+				}
+			}
+			else {
+				map<string, git_oid>::iterator it = local.find(src);
+				if(it == local.end()) {
+					baton->setError(GITERR_REFERENCE, "Reference '" + src +
+							"' not found.");
+					return false;
+				}
+				targets.push_back(pair<string, git_oid>(dst, it->second));
+				forced.push_back(baton->forces[i]);
+			}
+		}
+
+		for(size_t i = 0; i < targets.size(); i++) {
+			Refs::Update update;
+			update.name = targets[i].first;
+			update.newOid = targets[i].second;
+			update.checkOld = true;
+			map<string, git_oid>::const_iterator it = remoteRefs.find(update.name);
+			update.oldOid = it == remoteRefs.end() ? zero : it->second;
+			if(!git_oid_cmp(&update.oldOid, &update.newOid)) continue;
+
+			if(!forced[i] && !IsZero(update.oldOid) && !IsZero(update.newOid)) {
+				git_oid base;
+				repo->lockObjects();
+				int result = git_merge_base(&base, repo->repo_, &update.oldOid,
+						&update.newOid);
+				repo->unlockObjects();
+				giterr_clear();
+				if(result != GIT_OK || git_oid_cmp(&base, &update.oldOid)) {
+					baton->setError(GITERR_REFERENCE, "Updating '" + update.name +
+							"' isn't a fast-forward.");
+					return false;
+				}
+			}
+			updates->push_back(update);
+		}
+		return true;
+	}
+
+	/**
+		Pushing to a repository on this machine: the objects it's missing
+		(everything reachable from the new values that isn't from its current
+		refs) go over as one pack, written by the Packer and installed by the
+		Indexer, then all its refs are updated in one go. The refs are only
+		moved if they still are where they were when we started.
+	*/
+	void Remote::AsyncPush(uv_work_t *req) {
+		PushBaton *baton = GetBaton<PushBaton>(req);
+		Remote *remote = baton->remote_;
+
+		if(remote->localPath_.empty()) {
+			baton->setError(GITERR_NET,
+					"Only remotes on this machine can be pushed to.");
+			return;
+		}
+
+		git_repository *dst;
+		if(!AsyncLibCall(git_repository_open(&dst, remote->localPath_.c_str()),
+				baton)) {
+			return;
+		}
+		map<string, git_oid> remoteRefs;
+		bool ok = Transfer::ListHeads(dst, &remoteRefs, baton);
+		string packDir = string(git_repository_path(dst)) + "objects/pack";
+		git_repository_free(dst);
+
+		vector<Refs::Update> updates;
+		if(!ok || !PushUpdates(baton, remoteRefs, &updates) || updates.empty()) {
+			return;
+		}
+
+		Packer::Options options;
+		options.threads = baton->threads;
+		options.boundary = NULL;
+		for(size_t i = 0; i < updates.size(); i++) {
+			if(!IsZero(updates[i].newOid)) {
+				options.wants.push_back(updates[i].newOid);
+			}
+		}
+		for(map<string, git_oid>::iterator it = remoteRefs.begin();
+				it != remoteRefs.end(); ++it) {
+			options.haves.push_back(it->second);
+		}
+		if(!options.wants.empty() && !Transfer::InstallPacked(remote->repo_,
+				options, packDir, baton->progress, &baton->result, baton)) {
+			return;
+		}
+
+		// Opened again, so the new pack is seen.
+		if(!AsyncLibCall(git_repository_open(&dst, remote->localPath_.c_str()),
+				baton)) {
+			return;
+		}
+		git_odb *dstOdb;
+		if(AsyncLibCall(git_repository_odb(&dstOdb, dst), baton)) {
+			Refs::Apply(dst, dstOdb, updates, false, baton, &baton->changes);
+			git_odb_free(dstOdb);
+		}
+		git_repository_free(dst);
+	}
+
+	void Remote::AsyncAfterPush(uv_work_t *req) {
+		HandleScope scope;
+		PushBaton *baton = GetBaton<PushBaton>(req);
+
+		if(baton->progress) {
+			baton->progress->close();
+		}
+
+		if(baton->isErrored()) {
+			Handle<Value> argv[] = { baton->createV8Error() };
+			FireCallback(baton->callback, 1, argv);
+		}
+		else {
+			Handle<Object> summary = Object::New();
+			summary->Set(pack_objects_symbol, CastToJS(baton->result.objects));
+			summary->Set(pack_reused_symbol, CastToJS(baton->result.reused));
+			summary->Set(pack_deltas_symbol, CastToJS(baton->result.deltas));
+			summary->Set(stats_bytes_symbol,
+					CastToJS((double)baton->result.bytes));
+
+			Handle<Value> argv[] = { Undefined(), ChangesToJS(baton->changes),
+					summary };
+			FireCallback(baton->callback, 3, argv);
+		}
+
+		delete baton;
 	}
 
 };	// namespace gitteh
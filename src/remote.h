@@ -2,9 +2,15 @@
 #define GITTEH_REMOTE_H
 
 #include "gitteh.h"
+#include "refs.h"
+#include <map>
+#include <vector>
 
 namespace gitteh {
 	class RemoteBaton;
+	class DownloadBaton;
+	class PushBaton;
+	class Repository;
 
 	class Remote : public ObjectWrap {
 	public:
@@ -12,7 +18,7 @@ namespace gitteh {
 
 		static Persistent<FunctionTemplate> constructor_template;
 		static void Init(Handle<Object>);
-		Remote(git_remote*);
+		Remote(git_remote*, Repository*);
 		~Remote();
 
 	protected:
@@ -20,19 +26,31 @@ namespace gitteh {
 		static Handle<Value> UpdateTips(const Arguments&);
 		static Handle<Value> Connect(const Arguments&);
 		static Handle<Value> Download(const Arguments&);
+		static Handle<Value> Push(const Arguments&);
 
 	private:
 		git_remote *remote_;
-		git_indexer_stats indexerStats_;
-		git_off_t downloadBytes_;
+		Repository *repo_;
+		// Set for remotes on this machine, which are fetched from by gitteh
+		// itself rather than through libgit2.
+		string localPath_;
+		// What the last local download found, applied by updateTips.
+		std::vector<std::pair<string, git_oid> > localTips_;
 
-		static Handle<Value> GetStats(Local<String>, const AccessorInfo&);
 		static void AsyncUpdateTips(uv_work_t*);
 		static void AsyncAfterUpdateTips(uv_work_t*);
 		static void AsyncConnect(uv_work_t*);
 		static void AsyncAfterConnect(uv_work_t*);
+		static bool DownloadLocal(DownloadBaton*,
+				std::vector<std::pair<string, git_oid> >*);
 		static void AsyncDownload(uv_work_t*);
+		static void SampleDownload(uv_timer_t*, int);
+		static void FreeDownload(uv_handle_t*);
 		static void AsyncAfterDownload(uv_work_t*);
+		static bool PushUpdates(PushBaton*, const std::map<string, git_oid>&,
+				std::vector<Refs::Update>*);
+		static void AsyncPush(uv_work_t*);
+		static void AsyncAfterPush(uv_work_t*);
 	};
 };
 
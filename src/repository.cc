@@ -29,8 +29,19 @@
 #include "tag.h"
 #include "remote.h"
 #include "index.h"
+#include "checkout.h"
+#include "progress.h"
+#include "refs.h"
+#include "indexer.h"
+#include "bundle.h"
+#include "scheduler.h"
+#include "pool.h"
+#include "objectcache.h"
+#include <sys/stat.h>
+#include <map>
 
 using std::list;
+using std::vector;
 
 namespace gitteh {
 static Persistent<String> repo_class_symbol;
@@ -49,19 +60,54 @@ static Persistent<String> ref_name_symbol;
 static Persistent<String> ref_direct_symbol;
 static Persistent<String> ref_packed_symbol;
 static Persistent<String> ref_target_symbol;
+static Persistent<String> ref_oid_symbol;
+static Persistent<String> ref_peeled_symbol;
 
 static Persistent<String> object_id_symbol;
 static Persistent<String> object_type_symbol;
 
-class OpenRepoBaton : public Baton {
+static Persistent<String> pack_objects_symbol;
+static Persistent<String> pack_deltas_symbol;
+static Persistent<String> bundle_refs_symbol;
+static Persistent<String> bundle_prerequisites_symbol;
+
+class RepositoryBaton : public Baton {
+public:
+	Repository *repo;
+
+	RepositoryBaton(Repository *_repo) : Baton(), repo(_repo) {
+		repo->Ref();
+	};
+
+	// For pooled batons, which get their repository with setRepository().
+	RepositoryBaton() : Baton(), repo(NULL) { }
+
+	~RepositoryBaton() {
+		if(repo) repo->Unref();
+	}
+
+	void setRepository(Repository *_repo) {
+		repo = _repo;
+		repo->Ref();
+	}
+
+	void clear() {
+		if(repo) repo->Unref();
+		repo = NULL;
+	}
+};
+
+// repo is set when the path is open already, and only its contents have to
+// be listed.
+class OpenRepoBaton : public RepositoryBaton {
 public:
 	string path	;
-	git_repository *repo;
+	git_repository *opened;
 	list<string> remotes;
 	list<string> references;
 	list<string> submodules;
 
-	OpenRepoBaton(string path) : Baton(), path(path) {}	;
+	OpenRepoBaton(string path) : RepositoryBaton(), path(path), opened(NULL) {}	;
 };
 
 class InitRepoBaton : public Baton {
@@ -71,25 +117,11 @@ public:
 	git_repository *repo;
 };
 
-class RepositoryBaton : public Baton {
-public:
-	Repository *repo;
-
-	RepositoryBaton(Repository *_repo) : Baton(), repo(_repo) {
-		repo->Ref();
-	};
-
-	~RepositoryBaton() {
-		repo->Unref();
-	}
-};
-
+// Lookups are by far the most common calls, their batons are pooled.
 class ExistsBaton : public RepositoryBaton {
 public:
 	git_oid oid;
 	bool exists;
-
-	ExistsBaton(Repository *r, git_oid oid) : RepositoryBaton(r), oid(oid) {}
 };
 
 class GetObjectBaton : public RepositoryBaton {
@@ -98,30 +130,48 @@ public:
 	char oidLength;
 	git_object *object;
 	git_otype type;
-	GetObjectBaton(Repository *r, git_oid oid) : RepositoryBaton(r), oid(oid) {}
 };
 
+static BatonPool<ExistsBaton> existsBatons("exists");
+static BatonPool<GetObjectBaton> objectBatons("object");
+
 class ReferenceBaton : public RepositoryBaton {
 public:
 	git_reference *ref;
+	// Set instead of ref when the answer came from our packed-refs index.
+	bool fromPacked;
+	Refs::PackedRef packedRef;
+
 	ReferenceBaton(Repository *r) : RepositoryBaton(r) {
 		ref = NULL;
+		fromPacked = false;
+	}
+	ReferenceBaton() : RepositoryBaton() {
+		ref = NULL;
+		fromPacked = false;
 	}
 	~ReferenceBaton() {
 		if(ref) {
 			git_reference_free(ref);
 		}
 	}
+
+	void clear() {
+		if(ref) git_reference_free(ref);
+		ref = NULL;
+		fromPacked = false;
+		RepositoryBaton::clear();
+	}
 };
 
 class GetReferenceBaton : public ReferenceBaton {
 public:
 	string name;
 	bool resolve;
-
-	GetReferenceBaton(Repository *r, string _name) : ReferenceBaton(r), name(_name) {}
 };
 
+static BatonPool<GetReferenceBaton> referenceBatons("reference");
+
 class CreateReferenceBaton : public ReferenceBaton {
 public:
 	bool direct_;
@@ -172,16 +222,117 @@ public:
 	CreateRemoteBaton(Repository *r) : RepositoryBaton(r) { }
 };
 
+class CheckoutBaton : public RepositoryBaton {
+public:
+	git_oid treeId;
+	string path;
+	int threads;
+	Progress *progress;
+	Checkout::Result result;
+
+	CheckoutBaton(Repository *r) : RepositoryBaton(r) { }
+};
+
+class UpdateReferencesBaton : public RepositoryBaton {
+public:
+	vector<Refs::Update> updates;
+	bool packed;
+
+	UpdateReferencesBaton(Repository *r) : RepositoryBaton(r) { }
+};
+
+class PackReferencesBaton : public RepositoryBaton {
+public:
+	bool prune;
+	Refs::PackResult result;
+
+	PackReferencesBaton(Repository *r) : RepositoryBaton(r) { }
+};
+
+class ListReferencesBaton : public RepositoryBaton {
+public:
+	Refs::ListOptions options;
+	vector<Refs::ListedRef> refs;
+	bool more;
+
+	ListReferencesBaton(Repository *r) : RepositoryBaton(r) { }
+};
+
+class IndexPackBaton : public RepositoryBaton {
+public:
+	string path;
+	string packDir;
+	int threads;
+	Progress *progress;
+	Indexer::Result result;
+
+	IndexPackBaton(Repository *r) : RepositoryBaton(r) { }
+};
+
+class UnbundleBaton : public IndexPackBaton {
+public:
+	Bundle::Header header;
+
+	UnbundleBaton(Repository *r) : IndexPackBaton(r) { }
+};
+
 Persistent<FunctionTemplate> Repository::constructor_template;
 
+// Open repositories, by the path libgit2 settled on and by each absolute path
+// they were opened with, so that every openRepository of a repository shares
+// one set of handles (and the odb's mmaps and caches). Holds no references:
+// a Repository nobody has closed still goes when it's collected.
+// Main thread only.
+typedef std::map<string, Repository*> Registry;
+static Registry openRepositories;
+
 Repository::Repository() {
-	CREATE_MUTEX(gitLock_);
+	CREATE_MUTEX(objectLock_);
+	CREATE_MUTEX(refLock_);
+	CREATE_MUTEX(indexLock_);
+	CREATE_MUTEX(configLock_);
 
 	odb_ = NULL;
 	repo_ = NULL;
+	index_ = NULL;
+	packedRefs_ = NULL;
+	objectCache_ = new ObjectCache();
+	opens_ = 0;
 }
 
 Repository::~Repository() {
+	unregister();
+	release();
+	delete objectCache_;
+	objectCache_ = NULL;
+
+	DESTROY_MUTEX(configLock_);
+	DESTROY_MUTEX(indexLock_);
+	DESTROY_MUTEX(refLock_);
+	DESTROY_MUTEX(objectLock_);
+}
+
+void Repository::registerPath(const string &path) {
+	Registry::iterator it = openRepositories.find(path);
+	if(it != openRepositories.end()) return;
+	openRepositories[path] = this;
+	paths_.push_back(path);
+}
+
+void Repository::unregister() {
+	for(size_t i = 0; i < paths_.size(); i++) {
+		Registry::iterator it = openRepositories.find(paths_[i]);
+		if(it != openRepositories.end() && it->second == this) {
+			openRepositories.erase(it);
+		}
+	}
+	paths_.clear();
+}
+
+void Repository::release() {
+	// Holds references into repo_, so goes first.
+	objectCache_->clear();
+
 	if(odb_) {
 		git_odb_free(odb_);
 		odb_ = NULL;
@@ -197,15 +348,20 @@ Repository::~Repository() {
 		repo_ = NULL;
 	}
 
-	DESTROY_MUTEX(gitLock_);
+	delete packedRefs_;
+	packedRefs_ = NULL;
+}
 
-	/*delete commitCache_;
-	delete referenceCache_;
-	delete treeCache_;
-	delete tagCache_;
-	delete blobCache_;
+void Repository::close() {
+	if(opens_ == 0 || --opens_ > 0) return;
+	unregister();
+	if(refs_ == 0) release();
+}
 
-	close();*/
+void Repository::Unref() {
+	ObjectWrap::Unref();
+	// The last of the work that outlived close().
+	if(refs_ == 0 && opens_ == 0) release();
 }
 
 void Repository::Init(Handle<Object> target) {
@@ -227,23 +383,40 @@ void Repository::Init(Handle<Object> target) {
 	ref_direct_symbol 	= NODE_PSYMBOL("direct");
 	ref_packed_symbol 	= NODE_PSYMBOL("packed");
 	ref_target_symbol 	= NODE_PSYMBOL("target");
+	ref_oid_symbol 		= NODE_PSYMBOL("oid");
+	ref_peeled_symbol 	= NODE_PSYMBOL("peeled");
 
 	// Object symbols
 	object_id_symbol	= NODE_PSYMBOL("id");
 	object_type_symbol	= NODE_PSYMBOL("_type");
 
+	// Pack symbols
+	pack_objects_symbol	= NODE_PSYMBOL("objects");
+	pack_deltas_symbol	= NODE_PSYMBOL("deltas");
+	bundle_refs_symbol	= NODE_PSYMBOL("refs");
+	bundle_prerequisites_symbol = NODE_PSYMBOL("prerequisites");
+
 	Local<FunctionTemplate> t = FunctionTemplate::New(New);
 	constructor_template = Persistent<FunctionTemplate>::New(t);
 	constructor_template->SetClassName(repo_class_symbol);
 	t->InstanceTemplate()->SetInternalFieldCount(1);
 
 	NODE_SET_PROTOTYPE_METHOD(t, "object", GetObject);
+	NODE_SET_PROTOTYPE_METHOD(t, "objectSync", GetObjectSync);
 	NODE_SET_PROTOTYPE_METHOD(t, "exists", Exists);
 	NODE_SET_PROTOTYPE_METHOD(t, "reference", GetReference);
 	NODE_SET_PROTOTYPE_METHOD(t, "createOidReference", CreateOidReference);
 	NODE_SET_PROTOTYPE_METHOD(t, "createSymReference", CreateSymReference);
 	NODE_SET_PROTOTYPE_METHOD(t, "remote", GetRemote);
 	NODE_SET_PROTOTYPE_METHOD(t, "createRemote", CreateRemote);
+	NODE_SET_PROTOTYPE_METHOD(t, "checkout", CheckoutTree);
+	NODE_SET_PROTOTYPE_METHOD(t, "updateReferences", UpdateReferences);
+	NODE_SET_PROTOTYPE_METHOD(t, "packReferences", PackReferences);
+	NODE_SET_PROTOTYPE_METHOD(t, "listReferences", ListReferences);
+	NODE_SET_PROTOTYPE_METHOD(t, "indexPack", IndexPack);
+	NODE_SET_PROTOTYPE_METHOD(t, "unbundle", Unbundle);
+	NODE_SET_PROTOTYPE_METHOD(t, "close", Close);
+	NODE_SET_PROTOTYPE_METHOD(t, "reopen", Reopen);
 
 	NODE_SET_METHOD(target, "openRepository", OpenRepository);
 	NODE_SET_METHOD(target, "initRepository", InitRepository);
@@ -255,9 +428,6 @@ Handle<Value> Repository::New(const Arguments& args) {
 	HandleScope scope;
 
 	REQ_EXT_ARG(0, repoArg);
-	REQ_EXT_ARG(1, refsArg);
-	REQ_EXT_ARG(2, remotesArg);
-	REQ_EXT_ARG(3, submodulesArg);
 	Handle<Object> me = args.This();
 
 	git_repository *repo = static_cast<git_repository*>(repoArg->Value());
@@ -267,6 +437,7 @@ Handle<Value> Repository::New(const Arguments& args) {
 		return scope.Close(ThrowGitError());
 	}
 	if(git_repository_index(&index, repo) != GIT_OK) {
+		git_odb_free(odb);
 		return scope.Close(ThrowGitError());
 	}
 
@@ -276,6 +447,8 @@ Handle<Value> Repository::New(const Arguments& args) {
 	repoObj->repo_ = repo;
 	repoObj->odb_ = odb;
 	repoObj->index_ = index;
+	repoObj->packedRefs_ = new Refs::PackedIndex(
+			string(git_repository_path(repo)) + "packed-refs");
 
 	bool bare = git_repository_is_bare(repo);
 	ImmutableSet(me, path_symbol, CastToJS(git_repository_path(repo)));
@@ -283,30 +456,6 @@ Handle<Value> Repository::New(const Arguments& args) {
 	const char *workDir = git_repository_workdir(repo);
 	if(workDir) ImmutableSet(me, work_dir_symbol, CastToJS(workDir));
 
-	list<string> *remotes = static_cast<list<string>*>(remotesArg->Value());
-	if(remotes != NULL) {
-		ImmutableSet(me, remotes_symbol, CastToJS(*remotes));
-	}
-	else {
-		ImmutableSet(me, remotes_symbol, Array::New());
-	}
-
-	list<string> *references = static_cast<list<string>*>(refsArg->Value());
-	if(references != NULL) {
-		me->Set(references_symbol, CastToJS(*references));
-	}
-	else {
-		me->Set(references_symbol, Array::New());
-	}
-
-	list<string> *submodules = static_cast<list<string>*>(submodulesArg->Value());
-	if(submodules != NULL) {
-		me->Set(submodules_symbol, CastToJS(*submodules));
-	}
-	else {
-		me->Set(submodules_symbol, Array::New());
-	}
-
 	Handle<Value> constructorArgs[] = {
 		External::New(repoObj),
 		External::New(index)
@@ -319,14 +468,65 @@ Handle<Value> Repository::New(const Arguments& args) {
 	return args.This();
 }
 
+Repository *Repository::Adopt(git_repository *repo, const string &path) {
+	HandleScope scope;
+	Repository *repoObj;
+
+	Registry::iterator it = openRepositories.find(git_repository_path(repo));
+	if(it != openRepositories.end()) {
+		repoObj = it->second;
+		git_repository_free(repo);
+	}
+	else {
+		Handle<Value> constructorArgs[] = { External::New(repo) };
+		Local<Object> obj = Repository::constructor_template->GetFunction()
+						->NewInstance(1, constructorArgs);
+		if(obj.IsEmpty()) {
+			git_repository_free(repo);
+			return NULL;
+		}
+		repoObj = ObjectWrap::Unwrap<Repository>(obj);
+		repoObj->registerPath(git_repository_path(repoObj->repo_));
+	}
+
+	// A relative path means something else once the cwd changes.
+	if(!path.empty() && (path[0] == '/' || (path.size() > 1 && path[1] == ':'))) {
+		repoObj->registerPath(path);
+	}
+	repoObj->opens_++;
+	return repoObj;
+}
+
+Handle<Value> Repository::Close(const Arguments& args) {
+	HandleScope scope;
+	Repository *repo = ObjectWrap::Unwrap<Repository>(args.This());
+	repo->close();
+	return Undefined();
+}
+
+Handle<Value> Repository::Reopen(const Arguments& args) {
+	HandleScope scope;
+	Repository *repo = ObjectWrap::Unwrap<Repository>(args.This());
+	if(repo->opens_ == 0) {
+		return ThrowException(Exception::Error(
+				String::New("Repository is closed.")));
+	}
+	repo->opens_++;
+	return scope.Close(args.This());
+}
+
 Handle<Value> Repository::OpenRepository(const Arguments& args) {
 	HandleScope scope;
 
 	string path = CastFromJS<string>(args[0]);
 	OpenRepoBaton *baton = new OpenRepoBaton(path);
+	Registry::iterator it = openRepositories.find(path);
+	if(it != openRepositories.end()) {
+		baton->setRepository(it->second);
+		it->second->opens_++;
+	}
 	baton->setCallback(args[1]);
-	uv_queue_work(uv_default_loop(), &baton->req, AsyncOpenRepository,
-		AsyncAfterOpenRepository);
+	Scheduler::Queue(baton, AsyncOpenRepository, AsyncAfterOpenRepository);
 	return Undefined();
 }
 
@@ -336,31 +536,42 @@ int SubmoduleListCallback(const char *name, void *payload) {
 	return GIT_OK;
 }
 
-void Repository::AsyncOpenRepository(uv_work_t *req) {
-	OpenRepoBaton *baton = GetBaton<OpenRepoBaton>(req);
-
-	if(AsyncLibCall(git_repository_open(&baton->repo, baton->path.c_str()),
-			baton)) {
-		git_strarray strarray;
-		if(AsyncLibCall(git_remote_list(&strarray, baton->repo), baton)) {
-			for(unsigned int i = 0; i < strarray.count; i++) {
-				baton->remotes.push_back(string(strarray.strings[i]));
-			}
-			git_strarray_free(&strarray);
+void Repository::ListContents(git_repository *repo, OpenRepoBaton *baton) {
+	git_strarray strarray;
+	if(AsyncLibCall(git_remote_list(&strarray, repo), baton)) {
+		for(unsigned int i = 0; i < strarray.count; i++) {
+			baton->remotes.push_back(string(strarray.strings[i]));
 		}
+		git_strarray_free(&strarray);
+	}
 
-		if(AsyncLibCall(git_reference_list(&strarray, baton->repo,
-				GIT_REF_LISTALL), baton)) {
-			for(unsigned int i = 0; i < strarray.count; i++) {
-				baton->references.push_back(string(strarray.strings[i]));
-			}
-			git_strarray_free(&strarray);
+	if(AsyncLibCall(git_reference_list(&strarray, repo,
+			GIT_REF_LISTALL), baton)) {
+		for(unsigned int i = 0; i < strarray.count; i++) {
+			baton->references.push_back(string(strarray.strings[i]));
 		}
+		git_strarray_free(&strarray);
+	}
+
+	AsyncLibCall(git_submodule_foreach(repo, SubmoduleListCallback, baton),
+			baton);
+}
 
-		if(AsyncLibCall(git_submodule_foreach(baton->repo,
-				SubmoduleListCallback, baton), baton)) {
+void Repository::AsyncOpenRepository(uv_work_t *req) {
+	OpenRepoBaton *baton = GetBaton<OpenRepoBaton>(req);
 
-		}
+	if(baton->repo != NULL) {
+		// Already open, others may be using it.
+		Repository *repo = baton->repo;
+		repo->lockRefs();
+		repo->lockConfig();
+		ListContents(repo->repo_, baton);
+		repo->unlockConfig();
+		repo->unlockRefs();
+	}
+	else if(AsyncLibCall(git_repository_open(&baton->opened,
+			baton->path.c_str()), baton)) {
+		ListContents(baton->opened, baton);
 	}
 }
 
@@ -368,23 +579,33 @@ void Repository::AsyncAfterOpenRepository(uv_work_t *req) {
 	HandleScope scope;
 	OpenRepoBaton *baton = GetBaton<OpenRepoBaton>(req);
 
+	Repository *repo = baton->repo;
+	Handle<Value> error;
+	if(!baton->isErrored() && repo == NULL) {
+		TryCatch tryCatch;
+		repo = Adopt(baton->opened, baton->path);
+		baton->opened = NULL;
+		if(repo == NULL) error = tryCatch.Exception();
+	}
+
 	if(baton->isErrored()) {
+		if(repo != NULL) repo->close();
+		if(baton->opened != NULL) git_repository_free(baton->opened);
 		Handle<Value> argv[] = { baton->createV8Error() };
 		FireCallback(baton->callback, 1, argv);
 	}
+	else if(repo == NULL) {
+		Handle<Value> argv[] = { error };
+		FireCallback(baton->callback, 1, argv);
+	}
 	else {
-		// Call the Repository JS constructor to get our JS object.
-		Handle<Value> constructorArgs[] = {
-			External::New(baton->repo),
-			External::New(&baton->references),
-			External::New(&baton->remotes),
-			External::New(&baton->submodules)
-		};
-		Local<Object> obj = Repository::constructor_template->GetFunction()
-						->NewInstance(4, constructorArgs);
+		Handle<Object> contents = Object::New();
+		contents->Set(references_symbol, CastToJS(baton->references));
+		contents->Set(remotes_symbol, CastToJS(baton->remotes));
+		contents->Set(submodules_symbol, CastToJS(baton->submodules));
 
-		Handle<Value> argv[] = { Null(), obj };
-		FireCallback(baton->callback, 2, argv);
+		Handle<Value> argv[] = { Null(), repo->handle_, contents };
+		FireCallback(baton->callback, 3, argv);
 	}
 
 	delete baton;
@@ -396,8 +617,7 @@ Handle<Value> Repository::InitRepository(const Arguments& args) {
 	baton->path = CastFromJS<string>(args[0]);
 	baton->bare = CastFromJS<bool>(args[1]);
 	baton->setCallback(args[2]);
-	uv_queue_work(uv_default_loop(), &baton->req, AsyncInitRepository,
-		AsyncAfterInitRepository);
+	Scheduler::Queue(baton, AsyncInitRepository, AsyncAfterInitRepository);
 	return Undefined();
 }
 
@@ -417,16 +637,26 @@ void Repository::AsyncAfterInitRepository(uv_work_t *req) {
 		FireCallback(baton->callback, 1, argv);
 	}
 	else {
-		Handle<Value> constructorArgs[] = {
-			External::New(baton->repo),
-			External::New(NULL),
-			External::New(NULL)
-		};
-		Handle<Object> obj = Repository::constructor_template->GetFunction()
-						->NewInstance(3, constructorArgs);
+		Handle<Value> error;
+		Repository *repo;
+		{
+			TryCatch tryCatch;
+			repo = Adopt(baton->repo, baton->path);
+			if(repo == NULL) error = tryCatch.Exception();
+		}
+		if(repo == NULL) {
+			Handle<Value> argv[] = { error };
+			FireCallback(baton->callback, 1, argv);
+		}
+		else {
+			Handle<Object> contents = Object::New();
+			contents->Set(references_symbol, Array::New());
+			contents->Set(remotes_symbol, Array::New());
+			contents->Set(submodules_symbol, Array::New());
 
-		Handle<Value> argv[] = { Null(), obj };
-		FireCallback(baton->callback, 2, argv);
+			Handle<Value> argv[] = { Null(), repo->handle_, contents };
+			FireCallback(baton->callback, 3, argv);
+		}
 	}
 
 	delete baton;
@@ -436,22 +666,28 @@ Handle<Value> Repository::GetObject(const Arguments& args) {
 	HandleScope scope;
 	Repository *repo = ObjectWrap::Unwrap<Repository>(args.This());
 	Handle<String> oidArg = Handle<String>::Cast(args[0]);
-	GetObjectBaton *baton = new GetObjectBaton(repo, CastFromJS<git_oid>(args[0]));
+	GetObjectBaton *baton = objectBatons.acquire();
+	baton->setRepository(repo);
+	baton->oid = CastFromJS<git_oid>(args[0]);
 	baton->type = CastFromJS<git_otype>(args[1]);
 	baton->oidLength = oidArg->Length();
 	baton->setCallback(args[2]);
-	uv_queue_work(uv_default_loop(), &baton->req, AsyncGetObject, 
-		AsyncAfterGetObject);
+	Scheduler::Queue(baton, AsyncGetObject, AsyncAfterGetObject);
 	return Undefined();
 }
 
 void Repository::AsyncGetObject(uv_work_t *req) {
 	GetObjectBaton *baton = GetBaton<GetObjectBaton>(req);
 
-	baton->repo->lockRepository();
-	AsyncLibCall(git_object_lookup_prefix(&baton->object, baton->repo->repo_, 
-		&baton->oid, baton->oidLength, baton->type), baton);
-	baton->repo->unlockRepository();
+	Repository *repo = baton->repo;
+	repo->lockObjects();
+	if(AsyncLibCall(git_object_lookup_prefix(&baton->object, repo->repo_, 
+			&baton->oid, baton->oidLength, baton->type), baton)) {
+		repo->objectCache_->lock();
+		repo->objectCache_->add(repo->repo_, baton->object);
+		repo->objectCache_->unlock();
+	}
+	repo->unlockObjects();
 }
 
 void Repository::AsyncAfterGetObject(uv_work_t *req) {
@@ -463,66 +699,126 @@ void Repository::AsyncAfterGetObject(uv_work_t *req) {
 		FireCallback(baton->callback, 1, argv);
 	}
 	else {
-		git_object *gitObj = baton->object;
-		Handle<Object> jsObj;
-		git_otype type = git_object_type(gitObj);
-		switch(type) {
-			case GIT_OBJ_COMMIT: {
-				jsObj = Commit::Create((git_commit*)gitObj);
-				break;
-			}
-			case GIT_OBJ_TREE: {
-				jsObj = Tree::Create((git_tree*)gitObj);
-				break;
-			}
-			case GIT_OBJ_BLOB: {
-				jsObj = Blob::Create((git_blob*)gitObj);
-				break;
-			}
-			case GIT_OBJ_TAG: {
-				jsObj = Tag::Create((git_tag*)gitObj);
-				break;
-			}
-			default: {
-				Handle<String> err = String::New("Invalid object.");
-				Handle<Value> argv[] = { Exception::Error(err) };
-				FireCallback(baton->callback, 1, argv);
-				git_object_free(gitObj);
-				return;
-			}
+		Handle<Object> jsObj = CreateObject(baton->object);
+		git_object_free(baton->object);
+
+		if(jsObj.IsEmpty()) {
+			Handle<String> err = String::New("Invalid object.");
+			Handle<Value> argv[] = { Exception::Error(err) };
+			FireCallback(baton->callback, 1, argv);
+		}
+		else {
+			Handle<Value> argv[] = { Null(), jsObj };
+			FireCallback(baton->callback, 2, argv);
 		}
+	}
 
-		jsObj->Set(object_id_symbol, CastToJS(git_object_id(gitObj)));
-		jsObj->Set(object_type_symbol, Integer::New(git_object_type(gitObj)));
+	objectBatons.release(baton);
+}
 
-		git_object_free(gitObj);
+/**
+	Answers a lookup on the main thread, if that can be done without
+	waiting: the object has to be in the repository's ObjectCache, and the
+	cache's lock free. Anything else (including errors, a wrong type or an
+	abbreviated id) is undefined, and the caller goes through GetObject,
+	which will also see to it that the object is cached next time.
+*/
+Handle<Value> Repository::GetObjectSync(const Arguments& args) {
+	HandleScope scope;
+	Repository *repo = ObjectWrap::Unwrap<Repository>(args.This());
+	Handle<String> oidArg = Handle<String>::Cast(args[0]);
+	if(oidArg->Length() != GIT_OID_HEXSZ) return Undefined();
+	git_oid oid = CastFromJS<git_oid>(args[0]);
+	git_otype type = CastFromJS<git_otype>(args[1]);
+
+	if(!repo->objectCache_->tryLock()) return Undefined();
+	Handle<Object> jsObj;
+	git_object *gitObj = repo->objectCache_->lookup(oid);
+	if(gitObj != NULL &&
+			(type == GIT_OBJ_ANY || type == git_object_type(gitObj))) {
+		jsObj = CreateObject(gitObj);
+	}
+	repo->objectCache_->unlock();
 
-		Handle<Value> argv[] = { Null(), Local<Value>::New(jsObj) };
-		FireCallback(baton->callback, 2, argv);
+	if(jsObj.IsEmpty()) return Undefined();
+	return scope.Close(jsObj);
+}
+
+Handle<Object> Repository::CreateObject(git_object *gitObj) {
+	HandleScope scope;
+	Handle<Object> jsObj;
+	switch(git_object_type(gitObj)) {
+		case GIT_OBJ_COMMIT: {
+			jsObj = Commit::Create((git_commit*)gitObj);
+			break;
+		}
+		case GIT_OBJ_TREE: {
+			jsObj = Tree::Create((git_tree*)gitObj);
+			break;
+		}
+		case GIT_OBJ_BLOB: {
+			jsObj = Blob::Create((git_blob*)gitObj);
+			break;
+		}
+		case GIT_OBJ_TAG: {
+			jsObj = Tag::Create((git_tag*)gitObj);
+			break;
+		}
+		default: {
+			return Handle<Object>();
+		}
 	}
 
-	delete baton;
+	jsObj->Set(object_id_symbol, CastToJS(git_object_id(gitObj)));
+	jsObj->Set(object_type_symbol, Integer::New(git_object_type(gitObj)));
+	return scope.Close(jsObj);
 }
 
 Handle<Value> Repository::GetReference(const Arguments& args) {
 	HandleScope scope;
 	Repository *repo = ObjectWrap::Unwrap<Repository>(args.This());
 
-	GetReferenceBaton *baton = new GetReferenceBaton(repo, 
-		CastFromJS<string>(args[0]));
+	GetReferenceBaton *baton = referenceBatons.acquire();
+	baton->setRepository(repo);
+	baton->name = CastFromJS<string>(args[0]);
 	baton->resolve = CastFromJS<bool>(args[1]);
 	baton->setCallback(args[2]);
 
-	uv_queue_work(uv_default_loop(), &baton->req, AsyncGetReference,
-		AsyncReturnReference);
+	Scheduler::Queue(baton, AsyncGetReference, AsyncAfterGetReference);
 	return Undefined();
 }
 
 void Repository::AsyncGetReference(uv_work_t *req) {
 	GetReferenceBaton *baton = GetBaton<GetReferenceBaton>(req);
+	Repository *repo = baton->repo;
+
+	repo->lockRefs();
+
+	// Loose refs win over packed ones, so only names under refs/ that have
+	// no loose file can be answered from the packed index. A packed ref is
+	// always direct, so there's nothing to resolve either.
+	bool checkPacked = false;
+	if(!baton->name.compare(0, 5, "refs/")) {
+		struct stat st;
+		string loosePath = string(git_repository_path(repo->repo_)) +
+				baton->name;
+		checkPacked = lstat(loosePath.c_str(), &st) < 0 || S_ISDIR(st.st_mode);
+	}
+
+	if(checkPacked && repo->packedRefs_->refresh()) {
+		if(repo->packedRefs_->lookup(baton->name, &baton->packedRef)) {
+			baton->fromPacked = true;
+		}
+		else {
+			baton->setError(GITERR_REFERENCE, "Reference '" + baton->name +
+					"' not found");
+		}
+		repo->unlockRefs();
+		return;
+	}
 
 	git_reference *ref;
-	if(AsyncLibCall(git_reference_lookup(&ref, baton->repo->repo_,
+	if(AsyncLibCall(git_reference_lookup(&ref, repo->repo_,
 			baton->name.c_str()), baton)) {
 		if(baton->resolve) {
 			AsyncLibCall(git_reference_resolve(&baton->ref, ref), baton);
@@ -532,6 +828,8 @@ void Repository::AsyncGetReference(uv_work_t *req) {
 			baton->ref = ref;
 		}
 	}
+
+	repo->unlockRefs();
 }
 
 Handle<Value> Repository::CreateOidReference(const Arguments &args) {
@@ -542,8 +840,7 @@ Handle<Value> Repository::CreateOidReference(const Arguments &args) {
 			CastFromJS<bool>(args[2]));
 	baton->setCallback(args[3]);
 
-	uv_queue_work(uv_default_loop(), &baton->req, AsyncCreateReference,
-			AsyncReturnReference);
+	Scheduler::Queue(baton, AsyncCreateReference, AsyncReturnReference);
 
 	return Undefined();
 }
@@ -556,8 +853,7 @@ Handle<Value> Repository::CreateSymReference(const Arguments &args) {
 			CastFromJS<bool>(args[2]));
 	baton->setCallback(args[3]);
 
-	uv_queue_work(uv_default_loop(), &baton->req, AsyncCreateReference,
-			AsyncReturnReference);
+	Scheduler::Queue(baton, AsyncCreateReference, AsyncReturnReference);
 
 	return Undefined();
 }
@@ -565,6 +861,7 @@ Handle<Value> Repository::CreateSymReference(const Arguments &args) {
 void Repository::AsyncCreateReference(uv_work_t *req) {
 	CreateReferenceBaton *baton = GetBaton<CreateReferenceBaton>(req);
 
+	baton->repo->lockRefs();
 	if(baton->direct_) {
 		AsyncLibCall(git_reference_create_oid(&baton->ref, baton->repo->repo_,
 				baton->name_.c_str(), &baton->targetId_, baton->force_), baton);
@@ -574,23 +871,36 @@ void Repository::AsyncCreateReference(uv_work_t *req) {
 				baton->repo->repo_, baton->name_.c_str(),
 				baton->target_.c_str(), baton->force_), baton);
 	}
+	baton->repo->unlockRefs();
+}
+
+void Repository::AsyncAfterGetReference(uv_work_t *req) {
+	HandleScope scope;
+	GetReferenceBaton *baton = GetBaton<GetReferenceBaton>(req);
+	ReturnReference(baton);
+	referenceBatons.release(baton);
 }
 
 void Repository::AsyncReturnReference(uv_work_t *req) {
 	HandleScope scope;
 	ReferenceBaton *baton = GetBaton<ReferenceBaton>(req);
+	ReturnReference(baton);
+
+	// Deletion of this baton handles freeing the git_reference.
+	delete baton;
+}
 
+void Repository::ReturnReference(ReferenceBaton *baton) {
 	if(baton->isErrored()) {
 		Handle<Value> argv[] = { baton->createV8Error() };
 		FireCallback(baton->callback, 1, argv);
 	}
 	else {
-		Handle<Value> argv[] = { Null(), CreateReferenceObject(baton->ref) };
+		Handle<Value> argv[] = { Null(), baton->fromPacked ?
+				CreateReferenceObject(baton->packedRef) :
+				CreateReferenceObject(baton->ref) };
 		FireCallback(baton->callback, 2, argv);
 	}
-
-	// Deletion of this baton handles freeing the git_reference.
-	delete baton;
 }
 
 Handle<Object> Repository::CreateReferenceObject(git_reference *ref) {
@@ -613,6 +923,18 @@ Handle<Object> Repository::CreateReferenceObject(git_reference *ref) {
 	return scope.Close(obj);
 }
 
+Handle<Object> Repository::CreateReferenceObject(const Refs::PackedRef &ref) {
+	HandleScope scope;
+
+	Handle<Object> obj = Object::New();
+	obj->Set(ref_name_symbol, CastToJS(ref.name));
+	obj->Set(ref_direct_symbol, CastToJS<bool>(true));
+	obj->Set(ref_packed_symbol, CastToJS<bool>(true));
+	obj->Set(ref_target_symbol, CastToJS(ref.oid));
+
+	return scope.Close(obj);
+}
+
 Handle<Value> Repository::GetRemote(const Arguments& args) {
 	HandleScope scope;
 	Repository *repo = ObjectWrap::Unwrap<Repository>(args.This());
@@ -621,16 +943,17 @@ Handle<Value> Repository::GetRemote(const Arguments& args) {
 		CastFromJS<string>(args[0]));
 	baton->setCallback(args[1]);
 
-	uv_queue_work(uv_default_loop(), &baton->req, AsyncGetRemote,
-		AsyncAfterGetRemote);
+	Scheduler::Queue(baton, AsyncGetRemote, AsyncAfterGetRemote);
 	return Undefined();
 }
 
 void Repository::AsyncGetRemote(uv_work_t *req) {
 	GetRemoteBaton *baton = GetBaton<GetRemoteBaton>(req);
 
+	baton->repo->lockConfig();
 	AsyncLibCall(git_remote_load(&baton->remote, baton->repo->repo_, 
 		baton->name.c_str()), baton);
+	baton->repo->unlockConfig();
 }
 
 void Repository::AsyncAfterGetRemote(uv_work_t *req) {
@@ -642,9 +965,10 @@ void Repository::AsyncAfterGetRemote(uv_work_t *req) {
 		FireCallback(baton->callback, 1, argv);
 	}
 	else {
-		Handle<Value> constructorArgs[] = { External::New(baton->remote) };
+		Handle<Value> constructorArgs[] = { External::New(baton->remote),
+				External::New(baton->repo) };
 		Local<Object> obj = Remote::constructor_template->GetFunction()
-						->NewInstance(1, constructorArgs);
+						->NewInstance(2, constructorArgs);
 
 		Handle<Value> argv[] = { Null(), obj };
 		FireCallback(baton->callback, 2, argv);
@@ -662,8 +986,7 @@ Handle<Value> Repository::CreateRemote(const Arguments &args) {
 	baton->url = CastFromJS<string>(args[1]);
 	baton->setCallback(args[2]);
 
-	uv_queue_work(uv_default_loop(), &baton->req, AsyncCreateRemote,
-			AsyncAfterCreateRemote);
+	Scheduler::Queue(baton, AsyncCreateRemote, AsyncAfterCreateRemote);
 
 	return Undefined();
 }
@@ -671,12 +994,14 @@ Handle<Value> Repository::CreateRemote(const Arguments &args) {
 void Repository::AsyncCreateRemote(uv_work_t *req) {
 	CreateRemoteBaton *baton = GetBaton<CreateRemoteBaton>(req);
 
+	baton->repo->lockConfig();
 	if(AsyncLibCall(git_remote_add(&baton->remote, baton->repo->repo_,
 			baton->name.c_str(), baton->url.c_str()), baton)) {
 		if(!AsyncLibCall(git_remote_save(baton->remote), baton)) {
 			git_remote_free(baton->remote);
 		}
 	}
+	baton->repo->unlockConfig();
 }
 
 void Repository::AsyncAfterCreateRemote(uv_work_t *req) {
@@ -688,9 +1013,10 @@ void Repository::AsyncAfterCreateRemote(uv_work_t *req) {
 		FireCallback(baton->callback, 1, argv);
 	}
 	else {
-		Handle<Value> constructorArgs[] = { External::New(baton->remote) };
+		Handle<Value> constructorArgs[] = { External::New(baton->remote),
+				External::New(baton->repo) };
 		Local<Object> obj = Remote::constructor_template->GetFunction()
-						->NewInstance(1, constructorArgs);
+						->NewInstance(2, constructorArgs);
 
 		Handle<Value> argv[] = { Null(), obj };
 		FireCallback(baton->callback, 2, argv);
@@ -703,35 +1029,413 @@ Handle<Value> Repository::Exists(const Arguments& args) {
 	HandleScope scope;
 	Repository *repo = ObjectWrap::Unwrap<Repository>(args.This());
 
-	ExistsBaton *baton = new ExistsBaton(repo, CastFromJS<git_oid>(args[0]));
+	ExistsBaton *baton = existsBatons.acquire();
+	baton->setRepository(repo);
+	baton->oid = CastFromJS<git_oid>(args[0]);
 	baton->setCallback(args[1]);
 
-	uv_queue_work(uv_default_loop(), &baton->req, AsyncExists,
-		AsyncAfterExists);
+	Scheduler::Queue(baton, AsyncExists, AsyncAfterExists);
 	return Undefined();
 }
 
 void Repository::AsyncExists(uv_work_t *req) {
 	ExistsBaton *baton = GetBaton<ExistsBaton>(req);
+	baton->repo->lockObjects();
 	baton->exists = git_odb_exists(baton->repo->odb_, &baton->oid);
+	baton->repo->unlockObjects();
 }
 
 void Repository::AsyncAfterExists(uv_work_t *req) {
 	HandleScope scope;
 	ExistsBaton *baton = GetBaton<ExistsBaton>(req);
 
-	Handle<Value> argv[] = { Null(), Boolean::New(baton->exists) };
-	FireCallback(baton->callback, 2, argv);
+	if(baton->isErrored()) {
+		Handle<Value> argv[] = { baton->createV8Error() };
+		FireCallback(baton->callback, 1, argv);
+	}
+	else {
+		Handle<Value> argv[] = { Null(), Boolean::New(baton->exists) };
+		FireCallback(baton->callback, 2, argv);
+	}
+
+	existsBatons.release(baton);
+}
+
+Handle<Value> Repository::CheckoutTree(const Arguments &args) {
+	HandleScope scope;
+	Repository *repo = ObjectWrap::Unwrap<Repository>(args.This());
+
+	CheckoutBaton *baton = new CheckoutBaton(repo);
+	baton->treeId = CastFromJS<git_oid>(args[0]);
+	baton->path = CastFromJS<string>(args[1]);
+	baton->threads = CastFromJS<int>(args[2]);
+	baton->progress = NULL;
+	if(args[3]->IsFunction()) {
+		baton->progress = new Progress(args[3], Checkout::PROGRESS_FIELDS, 100);
+	}
+	baton->setCallback(args[4]);
+
+	Scheduler::Queue(baton, AsyncCheckoutTree, AsyncAfterCheckoutTree);
+
+	return Undefined();
+}
+
+void Repository::AsyncCheckoutTree(uv_work_t *req) {
+	CheckoutBaton *baton = GetBaton<CheckoutBaton>(req);
+
+	Checkout::Run(baton->repo, baton->treeId, baton->path, baton->threads,
+			baton->progress, &baton->result, baton);
+}
+
+void Repository::AsyncAfterCheckoutTree(uv_work_t *req) {
+	HandleScope scope;
+	CheckoutBaton *baton = GetBaton<CheckoutBaton>(req);
+
+	if(baton->progress) {
+		baton->progress->close();
+	}
+
+	if(baton->isErrored()) {
+		Handle<Value> argv[] = { baton->createV8Error() };
+		FireCallback(baton->callback, 1, argv);
+	}
+	else {
+		Handle<Value> argv[] = { Null(), CastToJS(baton->result.files) };
+		FireCallback(baton->callback, 2, argv);
+	}
+
+	delete baton;
+}
+
+Handle<Value> Repository::UpdateReferences(const Arguments &args) {
+	HandleScope scope;
+	Repository *repo = ObjectWrap::Unwrap<Repository>(args.This());
+
+	vector<string> names = CastFromJS<vector<string> >(args[0]);
+	vector<git_oid> newOids = CastFromJS<vector<git_oid> >(args[1]);
+	vector<string> oldOids = CastFromJS<vector<string> >(args[2]);
+
+	UpdateReferencesBaton *baton = new UpdateReferencesBaton(repo);
+	for(size_t i = 0; i < names.size(); i++) {
+		Refs::Update update;
+		update.name = names[i];
+		update.newOid = newOids[i];
+		// Empty string means "don't care what it was".
+		update.checkOld = !oldOids[i].empty();
+		memset(&update.oldOid, 0, sizeof(git_oid));
+		git_oid_fromstrn(&update.oldOid, oldOids[i].c_str(), oldOids[i].length());
+		baton->updates.push_back(update);
+	}
+	baton->packed = CastFromJS<bool>(args[3]);
+	baton->setCallback(args[4]);
+
+	Scheduler::Queue(baton, AsyncUpdateReferences, AsyncAfterUpdateReferences);
+
+	return Undefined();
+}
+
+void Repository::AsyncUpdateReferences(uv_work_t *req) {
+	UpdateReferencesBaton *baton = GetBaton<UpdateReferencesBaton>(req);
+
+	Refs::Apply(baton->repo, baton->updates, baton->packed, baton);
+}
+
+void Repository::AsyncAfterUpdateReferences(uv_work_t *req) {
+	HandleScope scope;
+	UpdateReferencesBaton *baton = GetBaton<UpdateReferencesBaton>(req);
+
+	baton->defaultCallback();
+
+	delete baton;
+}
+
+Handle<Value> Repository::PackReferences(const Arguments &args) {
+	HandleScope scope;
+	Repository *repo = ObjectWrap::Unwrap<Repository>(args.This());
+
+	PackReferencesBaton *baton = new PackReferencesBaton(repo);
+	baton->prune = CastFromJS<bool>(args[0]);
+	baton->setCallback(args[1]);
+
+	Scheduler::Queue(baton, AsyncPackReferences, AsyncAfterPackReferences);
+
+	return Undefined();
+}
+
+void Repository::AsyncPackReferences(uv_work_t *req) {
+	PackReferencesBaton *baton = GetBaton<PackReferencesBaton>(req);
+
+	Refs::Pack(baton->repo, baton->prune, &baton->result, baton);
+}
+
+void Repository::AsyncAfterPackReferences(uv_work_t *req) {
+	HandleScope scope;
+	PackReferencesBaton *baton = GetBaton<PackReferencesBaton>(req);
+
+	if(baton->isErrored()) {
+		Handle<Value> argv[] = { baton->createV8Error() };
+		FireCallback(baton->callback, 1, argv);
+	}
+	else {
+		Handle<Value> argv[] = { Null(), CastToJS(baton->result.packed),
+				CastToJS(baton->result.pruned) };
+		FireCallback(baton->callback, 3, argv);
+	}
+
+	delete baton;
+}
+
+Handle<Value> Repository::ListReferences(const Arguments &args) {
+	HandleScope scope;
+	Repository *repo = ObjectWrap::Unwrap<Repository>(args.This());
+
+	ListReferencesBaton *baton = new ListReferencesBaton(repo);
+	baton->options.prefix = CastFromJS<string>(args[0]);
+	baton->options.glob = CastFromJS<string>(args[1]);
+	baton->options.resolve = CastFromJS<bool>(args[2]);
+	baton->options.peelTags = CastFromJS<bool>(args[3]);
+	baton->options.limit = CastFromJS<unsigned int>(args[4]);
+	baton->options.after = CastFromJS<string>(args[5]);
+	baton->setCallback(args[6]);
+
+	Scheduler::Queue(baton, AsyncListReferences, AsyncAfterListReferences);
+
+	return Undefined();
+}
+
+void Repository::AsyncListReferences(uv_work_t *req) {
+	ListReferencesBaton *baton = GetBaton<ListReferencesBaton>(req);
+
+	Refs::List(baton->repo, baton->options, &baton->refs, &baton->more, baton);
+}
+
+void Repository::AsyncAfterListReferences(uv_work_t *req) {
+	HandleScope scope;
+	ListReferencesBaton *baton = GetBaton<ListReferencesBaton>(req);
+
+	if(baton->isErrored()) {
+		Handle<Value> argv[] = { baton->createV8Error() };
+		FireCallback(baton->callback, 1, argv);
+	}
+	else {
+		Handle<Array> refs = Array::New(baton->refs.size());
+		for(size_t i = 0; i < baton->refs.size(); i++) {
+			refs->Set(i, CreateListedReference(baton->refs[i]));
+		}
+
+		Handle<Value> argv[] = { Null(), refs, CastToJS(baton->more) };
+		FireCallback(baton->callback, 3, argv);
+	}
+
+	delete baton;
+}
+
+Handle<Object> Repository::CreateListedReference(const Refs::ListedRef &ref) {
+	HandleScope scope;
+	Handle<Object> obj = Object::New();
+	obj->Set(ref_name_symbol, CastToJS(ref.name));
+	obj->Set(ref_direct_symbol, CastToJS(ref.direct));
+	obj->Set(ref_target_symbol, CastToJS(ref.target));
+	obj->Set(ref_oid_symbol, ref.hasOid ?
+			CastToJS(ref.oid) : Handle<Value>(Null()));
+	obj->Set(ref_peeled_symbol, ref.hasPeel ?
+			CastToJS(ref.peel) : Handle<Value>(Null()));
+	return scope.Close(obj);
+}
+
+Handle<Value> Repository::IndexPack(const Arguments &args) {
+	HandleScope scope;
+	Repository *repo = ObjectWrap::Unwrap<Repository>(args.This());
+
+	IndexPackBaton *baton = new IndexPackBaton(repo);
+	baton->path = CastFromJS<string>(args[0]);
+	baton->packDir = string(git_repository_path(repo->repo_)) + "objects/pack";
+	baton->threads = CastFromJS<int>(args[1]);
+	baton->progress = NULL;
+	if(args[2]->IsFunction()) {
+		baton->progress = new Progress(args[2], Indexer::PROGRESS_FIELDS, 100);
+	}
+	baton->setCallback(args[3]);
+
+	Scheduler::Queue(baton, AsyncIndexPack, AsyncAfterIndexPack);
+
+	return Undefined();
+}
+
+void Repository::AsyncIndexPack(uv_work_t *req) {
+	IndexPackBaton *baton = GetBaton<IndexPackBaton>(req);
+
+	if(!Indexer::Run(baton->path, baton->packDir, baton->threads,
+			baton->progress, &baton->result, baton)) {
+		return;
+	}
+
+	baton->repo->lockObjects();
+	if(!baton->repo->reloadObjects()) {
+		baton->setError(giterr_last());
+	}
+	baton->repo->unlockObjects();
+}
+
+void Repository::AsyncAfterIndexPack(uv_work_t *req) {
+	HandleScope scope;
+	IndexPackBaton *baton = GetBaton<IndexPackBaton>(req);
+
+	if(baton->progress) {
+		baton->progress->close();
+	}
+
+	if(baton->isErrored()) {
+		Handle<Value> argv[] = { baton->createV8Error() };
+		FireCallback(baton->callback, 1, argv);
+	}
+	else {
+		Handle<Object> result = Object::New();
+		result->Set(object_id_symbol, CastToJS(baton->result.packId));
+		result->Set(pack_objects_symbol, CastToJS(baton->result.objects));
+		result->Set(pack_deltas_symbol, CastToJS(baton->result.deltas));
+		Handle<Value> argv[] = { Null(), result };
+		FireCallback(baton->callback, 2, argv);
+	}
 
 	delete baton;
 }
 
-void Repository::lockRepository() {
-	LOCK_MUTEX(gitLock_);
+Handle<Value> Repository::Unbundle(const Arguments &args) {
+	HandleScope scope;
+	Repository *repo = ObjectWrap::Unwrap<Repository>(args.This());
+
+	UnbundleBaton *baton = new UnbundleBaton(repo);
+	baton->path = CastFromJS<string>(args[0]);
+	baton->packDir = string(git_repository_path(repo->repo_)) + "objects/pack";
+	baton->threads = CastFromJS<int>(args[1]);
+	baton->progress = NULL;
+	if(args[2]->IsFunction()) {
+		baton->progress = new Progress(args[2], Indexer::PROGRESS_FIELDS, 100);
+	}
+	baton->setCallback(args[3]);
+
+	Scheduler::Queue(baton, AsyncUnbundle, AsyncAfterUnbundle);
+
+	return Undefined();
+}
+
+void Repository::AsyncUnbundle(uv_work_t *req) {
+	UnbundleBaton *baton = GetBaton<UnbundleBaton>(req);
+	Repository *repo = baton->repo;
+
+	off_t offset;
+	if(!Bundle::ReadHeader(baton->path, &baton->header, &offset, baton)) {
+		return;
+	}
+
+	repo->lockObjects();
+	for(size_t i = 0; i < baton->header.prerequisites.size(); i++) {
+		const git_oid *oid = &baton->header.prerequisites[i];
+		if(!git_odb_exists(repo->odb_, oid)) {
+			char hex[GIT_OID_HEXSZ + 1];
+			hex[GIT_OID_HEXSZ] = 0;
+			git_oid_fmt(hex, oid);
+			baton->setError(GITERR_ODB, string("Repository lacks the bundle's "
+					"prerequisite commit ") + hex + ".");
+			break;
+		}
+	}
+	repo->unlockObjects();
+	if(baton->isErrored()) return;
+
+	if(!Indexer::Run(baton->path, offset, baton->packDir, baton->threads,
+			baton->progress, &baton->result, baton)) {
+		return;
+	}
+
+	repo->lockObjects();
+	if(!repo->reloadObjects()) {
+		baton->setError(giterr_last());
+	}
+	repo->unlockObjects();
+}
+
+void Repository::AsyncAfterUnbundle(uv_work_t *req) {
+	HandleScope scope;
+	UnbundleBaton *baton = GetBaton<UnbundleBaton>(req);
+
+	if(baton->progress) {
+		baton->progress->close();
+	}
+
+	if(baton->isErrored()) {
+		Handle<Value> argv[] = { baton->createV8Error() };
+		FireCallback(baton->callback, 1, argv);
+	}
+	else {
+		Handle<Object> refs = Object::New();
+		for(size_t i = 0; i < baton->header.refs.size(); i++) {
+			refs->Set(CastToJS(baton->header.refs[i].first),
+					CastToJS(baton->header.refs[i].second));
+		}
+		Handle<Array> prerequisites = Array::New(
+				baton->header.prerequisites.size());
+		for(size_t i = 0; i < baton->header.prerequisites.size(); i++) {
+			prerequisites->Set(i, CastToJS(baton->header.prerequisites[i]));
+		}
+
+		Handle<Object> result = Object::New();
+		result->Set(object_id_symbol, CastToJS(baton->result.packId));
+		result->Set(pack_objects_symbol, CastToJS(baton->result.objects));
+		result->Set(pack_deltas_symbol, CastToJS(baton->result.deltas));
+		result->Set(bundle_refs_symbol, refs);
+		result->Set(bundle_prerequisites_symbol, prerequisites);
+		Handle<Value> argv[] = { Null(), result };
+		FireCallback(baton->callback, 2, argv);
+	}
+
+	delete baton;
+}
+
+bool Repository::reloadObjects() {
+	string path = string(git_repository_path(repo_)) + "objects";
+	git_odb *odb;
+	if(git_odb_open(&odb, path.c_str()) != GIT_OK) {
+		return false;
+	}
+
+	git_repository_set_odb(repo_, odb);
+	git_odb_free(odb_);
+	odb_ = odb;
+	return true;
+}
+
+void Repository::lockObjects() {
+	LOCK_MUTEX(objectLock_);
+}
+
+void Repository::unlockObjects() {
+	UNLOCK_MUTEX(objectLock_);
+}
+
+void Repository::lockRefs() {
+	LOCK_MUTEX(refLock_);
+}
+
+void Repository::unlockRefs() {
+	UNLOCK_MUTEX(refLock_);
+}
+
+void Repository::lockIndex() {
+	LOCK_MUTEX(indexLock_);
+}
+
+void Repository::unlockIndex() {
+	UNLOCK_MUTEX(indexLock_);
+}
+
+void Repository::lockConfig() {
+	LOCK_MUTEX(configLock_);
 }
 
-void Repository::unlockRepository() {
-	UNLOCK_MUTEX(gitLock_);
+void Repository::unlockConfig() {
+	UNLOCK_MUTEX(configLock_);
 }
 
 } // namespace gitteh
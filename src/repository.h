@@ -2,31 +2,77 @@
 #define GITTEH_REPO_H
 
 #include "gitteh.h"
+#include <vector>
 
 namespace gitteh {
 
 class RepositoryBaton;
+class OpenRepoBaton;
+class ReferenceBaton;
+class ObjectCache;
+
+namespace Refs {
+	struct PackedRef;
+	struct ListedRef;
+	class PackedIndex;
+};
 
 class Repository : public ObjectWrap {
 public:
 	static Persistent<FunctionTemplate> constructor_template;
 
 	friend class RepositoryBaton;
+	friend class RefWatcher;
+	friend class PackStream;
+	friend class Remote;
+	friend class Iterator;
+	friend class IndexBaton;
 	// template<class, class,class> friend class ObjectFactory;
 
 	Repository();
 	~Repository();
 	static void Init(Handle<Object>);
 
-	// Big ugly hacks, I hope to remove these someday. Pretty much any operation
-	// on a libgit2 repository needs to be locked to one thread at a time, as
-	// libgit2 is not thread safe in the slightest.
-	void lockRepository();
-	void unlockRepository();
+	// THREADSAFE only covers libgit2's init and object cache. Pack window
+	// lists, the pack backend's last found pack, revwalks and so on are
+	// unguarded, so one git_repository/git_odb can't be read from on two
+	// threads at once, and refs, the index and config are plain state too.
+	// Each has a lock of its own: a ref write doesn't hold up blob reads,
+	// but object reads do queue up behind each other. When more than one is
+	// needed they're taken in this order: refs, index, config, objects.
+
+	// Any use of repo_'s objects or odb_, and swapping the odb.
+	void lockObjects();
+	void unlockObjects();
+	void lockRefs();
+	void unlockRefs();
+	void lockIndex();
+	void unlockIndex();
+	// Remotes, and the attributes/ignore rules libgit2 caches from config.
+	void lockConfig();
+	void unlockConfig();
+
+	// libgit2 only rescans objects/pack when the directory's mtime (in
+	// seconds) changes, so a pack we install ourselves can go unnoticed.
+	// This swaps in a freshly opened object database. Caller holds the
+	// object lock.
+	bool reloadObjects();
+
+	// JS form of an object: the fields of its kind, plus id and type. Empty
+	// if object isn't one of the four kinds we know.
+	static Handle<Object> CreateObject(git_object*);
+	// {name, direct, target, oid, peeled}, as listReferences gives them.
+	static Handle<Object> CreateListedReference(const Refs::ListedRef&);
 
 	git_repository *repo_;
 	git_odb *odb_;
 	git_index *index_;
+	// Our own view of packed-refs, used to answer reference lookups without
+	// libgit2 reparsing the whole file. Guarded by the refs lock.
+	Refs::PackedIndex *packedRefs_;
+	// Small objects recently handed to JS, so GetObjectSync can answer
+	// without I/O. Has a lock of its own.
+	ObjectCache *objectCache_;
 
 protected:
 	static Handle<Value> OpenRepository(const Arguments&);
@@ -34,17 +80,41 @@ protected:
 
 	static Handle<Value> New(const Arguments&);
 	static Handle<Value> GetObject(const Arguments&);
+	static Handle<Value> GetObjectSync(const Arguments&);
 	static Handle<Value> GetReference(const Arguments&);
 	static Handle<Value> CreateOidReference(const Arguments&);
 	static Handle<Value> CreateSymReference(const Arguments&);
 	static Handle<Value> GetRemote(const Arguments&);
 	static Handle<Value> Exists(const Arguments&);
 	static Handle<Value> CreateRemote(const Arguments&);
-
+	static Handle<Value> CheckoutTree(const Arguments&);
+	static Handle<Value> UpdateReferences(const Arguments&);
+	static Handle<Value> PackReferences(const Arguments&);
+	static Handle<Value> ListReferences(const Arguments&);
+	static Handle<Value> IndexPack(const Arguments&);
+	static Handle<Value> Unbundle(const Arguments&);
+	static Handle<Value> Close(const Arguments&);
+	// Another open of a repository that's still open, without going back to
+	// disk. Closed like any other.
+	static Handle<Value> Reopen(const Arguments&);
+
+	// Called once for each openRepository that handed this out. When the
+	// last one has closed, the repository is dropped from the registry and
+	// the libgit2 handles (and their mmaps and descriptors) are freed, as
+	// soon as no work holds a reference.
 	void close();
+	virtual void Unref();
 
 private:
-	Handle<Value> wrapObject(git_object*);
+	// Main thread. The Repository for a freshly opened git_repository: the
+	// one already open at the same place (the new handle is then freed), or
+	// a new one, registered under its path and the path it was opened by.
+	// NULL if constructing one threw.
+	static Repository *Adopt(git_repository*, const string &path);
+	static void ListContents(git_repository*, OpenRepoBaton*);
+	void registerPath(const string&);
+	void unregister();
+	void release();
 
 	static void AsyncOpenRepository(uv_work_t*);
 	static void AsyncAfterOpenRepository(uv_work_t*);
@@ -55,30 +125,38 @@ private:
 	static void AsyncGetObject(uv_work_t*);
 	static void AsyncAfterGetObject(uv_work_t*);
 	static void AsyncGetReference(uv_work_t*);
+	static void AsyncAfterGetReference(uv_work_t*);
 	static void AsyncCreateReference(uv_work_t*);
 	static void AsyncReturnReference(uv_work_t*);
+	static void ReturnReference(ReferenceBaton*);
 	static void AsyncGetRemote(uv_work_t*);
 	static void AsyncAfterGetRemote(uv_work_t*);
 	static void AsyncCreateRemote(uv_work_t*);
 	static void AsyncAfterCreateRemote(uv_work_t*);
+	static void AsyncCheckoutTree(uv_work_t*);
+	static void AsyncAfterCheckoutTree(uv_work_t*);
+	static void AsyncUpdateReferences(uv_work_t*);
+	static void AsyncAfterUpdateReferences(uv_work_t*);
+	static void AsyncPackReferences(uv_work_t*);
+	static void AsyncAfterPackReferences(uv_work_t*);
+	static void AsyncListReferences(uv_work_t*);
+	static void AsyncAfterListReferences(uv_work_t*);
+	static void AsyncIndexPack(uv_work_t*);
+	static void AsyncAfterIndexPack(uv_work_t*);
+	static void AsyncUnbundle(uv_work_t*);
+	static void AsyncAfterUnbundle(uv_work_t*);
 
 	static Handle<Object> CreateReferenceObject(git_reference*);
-	
-	// For now, I'm using one lock for anything that calls a git_* api function.
-	// I could probably have different locks for different sections of libgit2,
-	// as I'm sure working on the index file or working on a specific ref isn't
-	// going to step on the toes of a simultaneous call to get a tree entry for
-	// example. However for now I want this thing to *just work*, I'll worry 
-	// about making it a speed demon later. Ideally libgit2 will become thread
-	// safe internally, then I can remove all this shit!
-	gitteh_lock gitLock_;
-
-	// This lock is used during ref packing. The problem is ref packing will
-	// invalidate our previously cached pointers. Ugh. So what we do is update
-	// those pointers after we pack references right? Cool. Only thing is with
-	// async that process might get fucked if we don't stop any more refs from
-	// being opened created while we're in the process of packing. Hence this lock.
-	// gitteh_lock refLock_;
+	static Handle<Object> CreateReferenceObject(const Refs::PackedRef&);
+
+	gitteh_lock objectLock_;
+	gitteh_lock refLock_;
+	gitteh_lock indexLock_;
+	gitteh_lock configLock_;
+
+	// Paths this is registered under, and how many opens haven't closed.
+	std::vector<string> paths_;
+	int opens_;
 };
 
 } // namespace gitteh
@@ -0,0 +1,409 @@
+#include "scheduler.h"
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <vector>
+#include <stdlib.h>
+
+namespace gitteh {
+	namespace Scheduler {
+		static Persistent<String> concurrency_symbol;
+		static Persistent<String> background_concurrency_symbol;
+		static Persistent<String> running_symbol;
+		static Persistent<String> queued_symbol;
+		static Persistent<String> completed_symbol;
+		static Persistent<String> cancelled_symbol;
+		static Persistent<String> lanes_symbol;
+		static Persistent<String> interactive_symbol;
+		static Persistent<String> normal_symbol;
+		static Persistent<String> background_symbol;
+
+		// Same as libuv's threadpool when UV_THREADPOOL_SIZE isn't set.
+		static const int DEFAULT_CONCURRENCY = 4;
+
+		struct Lane {
+			std::deque<Baton*> queued;
+			int running;
+			double completed;
+			double cancelled;
+		};
+
+		static Lane lanes[PRIORITIES];
+		static int running = 0;
+		static int concurrency = DEFAULT_CONCURRENCY;
+		static int backgroundConcurrency = 1;
+		static int currentPriority = NORMAL;
+		static int currentTimeout = 0;
+
+		// Every baton queued or running, by id.
+		static std::map<unsigned int, Baton*> live;
+		static unsigned int lastId = 0;
+
+		// Batons given up on before they ran. Their after callbacks fire from
+		// skipTimer, so user callbacks never run from inside cancel().
+		static std::deque<Baton*> skipped;
+		static uv_timer_t skipTimer;
+
+		// Goes off when the earliest deadline of a queued baton has passed.
+		static uv_timer_t deadlineTimer;
+		static uint64_t armedDeadline = 0;
+
+		static void Dispatch();
+		static void CheckDeadlines(uv_timer_t*, int);
+
+		static void FireSkipped(uv_timer_t *handle, int status) {
+			std::deque<Baton*> batons;
+			batons.swap(skipped);
+			for(size_t i = 0; i < batons.size(); i++) {
+				Baton *baton = batons[i];
+				live.erase(baton->id);
+				lanes[baton->priority].cancelled++;
+				// Errored out, so it just fires the callback with the error.
+				baton->after(&baton->req);
+			}
+		}
+
+		static void Skip(Baton *baton) {
+			baton->cancelPoint();
+			skipped.push_back(baton);
+			uv_timer_start(&skipTimer, FireSkipped, 0, 0);
+		}
+
+		static void ArmDeadlineTimer(uint64_t deadline) {
+			uint64_t now = uv_hrtime();
+			uint64_t ms = deadline > now ? (deadline - now) / 1000000 + 1 : 0;
+			armedDeadline = deadline;
+			uv_timer_start(&deadlineTimer, CheckDeadlines, ms, 0);
+		}
+
+		static void CheckDeadlines(uv_timer_t *handle, int status) {
+			uint64_t now = uv_hrtime();
+			uint64_t next = 0;
+			for(int i = 0; i < PRIORITIES; i++) {
+				std::deque<Baton*> &queued = lanes[i].queued;
+				for(size_t j = 0; j < queued.size();) {
+					Baton *baton = queued[j];
+					if(baton->deadline == 0) {
+						j++;
+					}
+					else if(baton->deadline <= now) {
+						queued.erase(queued.begin() + j);
+						Skip(baton);
+					}
+					else {
+						if(next == 0 || baton->deadline < next) next = baton->deadline;
+						j++;
+					}
+				}
+			}
+			armedDeadline = 0;
+			if(next) ArmDeadlineTimer(next);
+		}
+
+		// Handed from Dispatch to the workers, and back once done. Both
+		// guarded by workLock.
+		static std::deque<Baton*> ready;
+		static std::vector<Baton*> finished;
+		static gitteh_lock workLock;
+		static gitteh_cond readyCond;
+		static int workers = 0;
+		// Wakes the main thread up for however many batons have finished.
+		static uv_async_t finishedAsync;
+		static bool referenced = false;
+
+		static void *WorkerMain(void *payload) {
+			LOCK_MUTEX(workLock);
+			while(true) {
+				while(ready.empty()) {
+					WAIT_COND(readyCond, workLock);
+				}
+				Baton *baton = ready.front();
+				ready.pop_front();
+				UNLOCK_MUTEX(workLock);
+
+				baton->work(&baton->req);
+
+				LOCK_MUTEX(workLock);
+				// Only the first of a burst has to wake the main thread up, the
+				// rest are picked up by the same drain.
+				bool wake = finished.empty();
+				finished.push_back(baton);
+				if(wake) uv_async_send(&finishedAsync);
+			}
+			return NULL;
+		}
+
+		/**
+			Runs the after callbacks of everything that finished since the last
+			wakeup in one go, then refills the workers once.
+		*/
+		static void AfterWork(uv_async_t *handle, int status) {
+			HandleScope scope;
+			static std::vector<Baton*> batons;
+
+			LOCK_MUTEX(workLock);
+			batons.swap(finished);
+			UNLOCK_MUTEX(workLock);
+
+			for(size_t i = 0; i < batons.size(); i++) {
+				Baton *baton = batons[i];
+				Lane &lane = lanes[baton->priority];
+				live.erase(baton->id);
+
+				// Usually deletes the baton. Work that got to the end before it
+				// noticed a cancel reports its result as usual, it's done anyway.
+				baton->after(&baton->req);
+
+				lane.running--;
+				lane.completed++;
+				running--;
+			}
+			batons.clear();
+			Dispatch();
+
+			// Nothing running, the loop shouldn't wait on us.
+			if(running == 0 && referenced) {
+				uv_unref((uv_handle_t*)&finishedAsync);
+				referenced = false;
+			}
+		}
+
+		static void StartWork(Baton *baton) {
+			if(!referenced) {
+				uv_ref((uv_handle_t*)&finishedAsync);
+				referenced = true;
+			}
+
+			LOCK_MUTEX(workLock);
+			while(workers < concurrency) {
+				gitteh_thread thread;
+				if(CREATE_THREAD(thread, WorkerMain, NULL) != 0) break;
+				workers++;
+			}
+			if(workers == 0) {
+				// Nobody to run it, it can only fail.
+				baton->setError(GITERR_OS, "Failed to start a worker thread.");
+				bool wake = finished.empty();
+				finished.push_back(baton);
+				if(wake) uv_async_send(&finishedAsync);
+			}
+			else {
+				ready.push_back(baton);
+				SIGNAL_COND(readyCond);
+			}
+			UNLOCK_MUTEX(workLock);
+		}
+
+		static void Dispatch() {
+			while(running < concurrency) {
+				Lane *lane = NULL;
+				for(int i = 0; i < PRIORITIES; i++) {
+					if(lanes[i].queued.empty()) continue;
+					if(i == BACKGROUND && lanes[i].running >= backgroundConcurrency) {
+						continue;
+					}
+					lane = &lanes[i];
+					break;
+				}
+				if(lane == NULL) break;
+
+				Baton *baton = lane->queued.front();
+				lane->queued.pop_front();
+				if(baton->isCancelled()) {
+					Skip(baton);
+					continue;
+				}
+				lane->running++;
+				running++;
+				StartWork(baton);
+			}
+
+			// Nothing left waiting, so no deadline to watch for either (and
+			// no reason to keep the loop alive).
+			if(armedDeadline) {
+				for(int i = 0; i < PRIORITIES; i++) {
+					if(!lanes[i].queued.empty()) return;
+				}
+				uv_timer_stop(&deadlineTimer);
+				armedDeadline = 0;
+			}
+		}
+
+		void Queue(Baton *baton, uv_work_cb work, uv_after_work_cb after) {
+			baton->work = work;
+			baton->after = after;
+			baton->id = ++lastId;
+			live[baton->id] = baton;
+			lanes[baton->priority].queued.push_back(baton);
+			if(baton->deadline &&
+					(armedDeadline == 0 || baton->deadline < armedDeadline)) {
+				ArmDeadlineTimer(baton->deadline);
+			}
+			Dispatch();
+		}
+
+		int Cancel(const std::vector<unsigned int> &ids, int code) {
+			int found = 0;
+			for(size_t i = 0; i < ids.size(); i++) {
+				std::map<unsigned int, Baton*>::iterator it = live.find(ids[i]);
+				if(it == live.end()) continue;
+				Baton *baton = it->second;
+				if(baton->cancelCode) continue;
+				found++;
+				baton->cancelCode = code;
+
+				std::deque<Baton*> &queued = lanes[baton->priority].queued;
+				std::deque<Baton*>::iterator pos = std::find(queued.begin(),
+						queued.end(), baton);
+				if(pos != queued.end()) {
+					queued.erase(pos);
+					Skip(baton);
+				}
+			}
+			return found;
+		}
+
+		int CurrentPriority() {
+			return currentPriority;
+		}
+
+		int CurrentTimeout() {
+			return currentTimeout;
+		}
+
+		// Sets the priority batons get from now on, returns the previous one.
+		static Handle<Value> SetPriority(const Arguments &args) {
+			HandleScope scope;
+			int priority = CastFromJS<int>(args[0]);
+			if(priority < 0 || priority >= PRIORITIES) {
+				return ThrowException(Exception::RangeError(
+						String::New("Invalid priority.")));
+			}
+			int previous = currentPriority;
+			currentPriority = priority;
+			return scope.Close(CastToJS(previous));
+		}
+
+		// Same for the timeout, in milliseconds (0 for none).
+		static Handle<Value> SetTimeout(const Arguments &args) {
+			HandleScope scope;
+			int timeout = CastFromJS<int>(args[0]);
+			if(timeout < 0) {
+				return ThrowException(Exception::RangeError(
+						String::New("Invalid timeout.")));
+			}
+			int previous = currentTimeout;
+			currentTimeout = timeout;
+			return scope.Close(CastToJS(previous));
+		}
+
+		// Id of the last request queued, requests queued later get higher ids.
+		static Handle<Value> LastRequestId(const Arguments &args) {
+			HandleScope scope;
+			return scope.Close(Number::New(lastId));
+		}
+
+		static Handle<Value> CancelRequests(const Arguments &args) {
+			HandleScope scope;
+			std::vector<unsigned int> ids;
+			if(args[0]->IsArray()) {
+				Handle<Array> list = Handle<Array>::Cast(args[0]);
+				for(uint32_t i = 0; i < list->Length(); i++) {
+					ids.push_back(list->Get(i)->Uint32Value());
+				}
+			}
+			int code = args[1]->IsTrue() ? GITTEH_ETIMEDOUT : GITTEH_ECANCELLED;
+			return scope.Close(CastToJS(Cancel(ids, code)));
+		}
+
+		static Handle<Value> Configure(const Arguments &args) {
+			HandleScope scope;
+			int newConcurrency = CastFromJS<int>(args[0]);
+			int newBackground = CastFromJS<int>(args[1]);
+			if(newConcurrency < 1 || newBackground < 1) {
+				return ThrowException(Exception::RangeError(
+						String::New("Concurrency limits must be positive.")));
+			}
+			concurrency = newConcurrency;
+			backgroundConcurrency = newBackground;
+			Dispatch();
+			return Undefined();
+		}
+
+		static Handle<Value> Stats(const Arguments &args) {
+			HandleScope scope;
+			Handle<Object> stats = Object::New();
+			stats->Set(concurrency_symbol, CastToJS(concurrency));
+			stats->Set(background_concurrency_symbol,
+					CastToJS(backgroundConcurrency));
+			stats->Set(running_symbol, CastToJS(running));
+
+			Handle<Object> laneStats = Object::New();
+			Persistent<String> *names[PRIORITIES] = { &interactive_symbol,
+					&normal_symbol, &background_symbol };
+			for(int i = 0; i < PRIORITIES; i++) {
+				Handle<Object> lane = Object::New();
+				lane->Set(queued_symbol, CastToJS((int)lanes[i].queued.size()));
+				lane->Set(running_symbol, CastToJS(lanes[i].running));
+				lane->Set(completed_symbol, Number::New(lanes[i].completed));
+				lane->Set(cancelled_symbol, Number::New(lanes[i].cancelled));
+				laneStats->Set(*names[i], lane);
+			}
+			stats->Set(lanes_symbol, laneStats);
+			return scope.Close(stats);
+		}
+
+		void Init(Handle<Object> target) {
+			HandleScope scope;
+
+			concurrency_symbol = NODE_PSYMBOL("concurrency");
+			background_concurrency_symbol = NODE_PSYMBOL("backgroundConcurrency");
+			running_symbol = NODE_PSYMBOL("running");
+			queued_symbol = NODE_PSYMBOL("queued");
+			completed_symbol = NODE_PSYMBOL("completed");
+			cancelled_symbol = NODE_PSYMBOL("cancelled");
+			lanes_symbol = NODE_PSYMBOL("lanes");
+			interactive_symbol = NODE_PSYMBOL("interactive");
+			normal_symbol = NODE_PSYMBOL("normal");
+			background_symbol = NODE_PSYMBOL("background");
+
+			const char *poolSize = getenv("UV_THREADPOOL_SIZE");
+			if(poolSize != NULL && atoi(poolSize) > 0) {
+				concurrency = atoi(poolSize);
+			}
+			backgroundConcurrency = concurrency / 4 > 1 ? concurrency / 4 : 1;
+
+			Handle<Object> priorities = Object::New();
+			ImmutableSet(priorities, interactive_symbol, CastToJS((int)INTERACTIVE));
+			ImmutableSet(priorities, normal_symbol, CastToJS((int)NORMAL));
+			ImmutableSet(priorities, background_symbol, CastToJS((int)BACKGROUND));
+			ImmutableSet(target, String::NewSymbol("priorities"), priorities);
+
+			Handle<Object> errorCodes = Object::New();
+			ImmutableSet(errorCodes, cancelled_symbol,
+					CastToJS((int)GITTEH_ECANCELLED));
+			ImmutableSet(errorCodes, String::NewSymbol("timedOut"),
+					CastToJS((int)GITTEH_ETIMEDOUT));
+			ImmutableSet(errorCodes, String::NewSymbol("busy"),
+					CastToJS((int)GITTEH_EBUSY));
+			ImmutableSet(errorCodes, String::NewSymbol("closed"),
+					CastToJS((int)GITTEH_ECLOSED));
+			ImmutableSet(target, String::NewSymbol("errorCodes"), errorCodes);
+
+			CREATE_MUTEX(workLock);
+			CREATE_COND(readyCond);
+			uv_async_init(uv_default_loop(), &finishedAsync, AfterWork);
+			uv_unref((uv_handle_t*)&finishedAsync);
+
+			uv_timer_init(uv_default_loop(), &skipTimer);
+			uv_timer_init(uv_default_loop(), &deadlineTimer);
+
+			NODE_SET_METHOD(target, "setPriority", SetPriority);
+			NODE_SET_METHOD(target, "setRequestTimeout", SetTimeout);
+			NODE_SET_METHOD(target, "lastRequestId", LastRequestId);
+			NODE_SET_METHOD(target, "cancelRequests", CancelRequests);
+			NODE_SET_METHOD(target, "configureScheduler", Configure);
+			NODE_SET_METHOD(target, "schedulerStats", Stats);
+		}
+	};
+}; // namespace gitteh
@@ -0,0 +1,63 @@
+#ifndef GITTEH_SCHEDULER_H
+#define GITTEH_SCHEDULER_H
+
+#include "gitteh.h"
+#include <vector>
+
+namespace gitteh {
+	/**
+		Runs the work of every baton. A plain threadpool runs work in the
+		order it was queued, so a lookup the user is waiting on can end up
+		behind a pile of background fetches. Instead batons are kept in a lane
+		per priority here, and only handed to the worker threads while fewer
+		than `concurrency` are running (4 by default, or UV_THREADPOOL_SIZE),
+		highest priority lane first. Background work is further limited to
+		`backgroundConcurrency` at once, so some of the workers are always left
+		for everything else.
+
+		The workers are our own rather than the uv threadpool's, so finished
+		work doesn't cost a trip through the loop each: a burst of completions
+		wakes the main thread up once, and their after callbacks run back to
+		back under one HandleScope.
+
+		Requests can be cancelled, and given a deadline. One that hasn't
+		started yet is simply dropped, its callback gets a cancelled (or timed
+		out) error. One that's running is told so through its baton, long
+		running work checks Baton::cancelPoint() now and then and gives up.
+
+		Apart from the hand-off to the workers, everything here happens on
+		the main thread.
+	*/
+	namespace Scheduler {
+		enum Priority {
+			INTERACTIVE,
+			NORMAL,
+			BACKGROUND,
+			PRIORITIES
+		};
+
+		void Init(Handle<Object>);
+
+		/**
+			Queues the work for baton in its priority's lane. The work and
+			after callbacks are the same as uv_queue_work's (work runs on a
+			worker thread, after on the main thread), after is free to delete
+			the baton.
+		*/
+		void Queue(Baton*, uv_work_cb, uv_after_work_cb);
+
+		/**
+			Cancels the requests with given ids, with code GITTEH_ECANCELLED or
+			GITTEH_ETIMEDOUT. Ids that already finished are ignored. Returns
+			how many were cancelled.
+		*/
+		int Cancel(const std::vector<unsigned int> &ids, int code);
+
+		// Priority and timeout (in ms) new batons get, set from JS around a
+		// call.
+		int CurrentPriority();
+		int CurrentTimeout();
+	};
+}; // namespace gitteh
+
+#endif // GITTEH_SCHEDULER_H
@@ -0,0 +1,104 @@
+#include "sha1.h"
+#include <string.h>
+
+namespace gitteh {
+	static inline uint32_t Rol(uint32_t value, int bits) {
+		return (value << bits) | (value >> (32 - bits));
+	}
+
+	Sha1::Sha1() : length_(0), buffered_(0) {
+		state_[0] = 0x67452301;
+		state_[1] = 0xefcdab89;
+		state_[2] = 0x98badcfe;
+		state_[3] = 0x10325476;
+		state_[4] = 0xc3d2e1f0;
+	}
+
+	void Sha1::block(const unsigned char *data) {
+		uint32_t w[80];
+		for(int i = 0; i < 16; i++) {
+			w[i] = (uint32_t)data[i * 4] << 24 | (uint32_t)data[i * 4 + 1] << 16 |
+					(uint32_t)data[i * 4 + 2] << 8 | (uint32_t)data[i * 4 + 3];
+		}
+		for(int i = 16; i < 80; i++) {
+			w[i] = Rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+		}
+
+		uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3],
+				e = state_[4];
+		for(int i = 0; i < 80; i++) {
+			uint32_t f, k;
+			if(i < 20) {
+				f = (b & c) | (~b & d);
+				k = 0x5a827999;
+			}
+			else if(i < 40) {
+				f = b ^ c ^ d;
+				k = 0x6ed9eba1;
+			}
+			else if(i < 60) {
+				f = (b & c) | (b & d) | (c & d);
+				k = 0x8f1bbcdc;
+			}
+			else {
+				f = b ^ c ^ d;
+				k = 0xca62c1d6;
+			}
+			uint32_t temp = Rol(a, 5) + f + e + k + w[i];
+			e = d;
+			d = c;
+			c = Rol(b, 30);
+			b = a;
+			a = temp;
+		}
+
+		state_[0] += a;
+		state_[1] += b;
+		state_[2] += c;
+		state_[3] += d;
+		state_[4] += e;
+	}
+
+	void Sha1::update(const void *data, size_t len) {
+		const unsigned char *bytes = static_cast<const unsigned char*>(data);
+		length_ += len;
+
+		if(buffered_) {
+			size_t take = 64 - buffered_;
+			if(take > len) take = len;
+			memcpy(buffer_ + buffered_, bytes, take);
+			buffered_ += take;
+			bytes += take;
+			len -= take;
+			if(buffered_ < 64) return;
+			block(buffer_);
+			buffered_ = 0;
+		}
+
+		for(; len >= 64; bytes += 64, len -= 64) {
+			block(bytes);
+		}
+
+		memcpy(buffer_, bytes, len);
+		buffered_ = len;
+	}
+
+	void Sha1::final(unsigned char digest[20]) {
+		uint64_t bits = length_ * 8;
+		unsigned char pad[72];
+		size_t padLen = (buffered_ < 56 ? 56 : 120) - buffered_;
+		memset(pad, 0, sizeof(pad));
+		pad[0] = 0x80;
+		for(int i = 0; i < 8; i++) {
+			pad[padLen + i] = (unsigned char)(bits >> (56 - i * 8));
+		}
+		update(pad, padLen + 8);
+
+		for(int i = 0; i < 5; i++) {
+			digest[i * 4] = (unsigned char)(state_[i] >> 24);
+			digest[i * 4 + 1] = (unsigned char)(state_[i] >> 16);
+			digest[i * 4 + 2] = (unsigned char)(state_[i] >> 8);
+			digest[i * 4 + 3] = (unsigned char)state_[i];
+		}
+	}
+}; // namespace gitteh
@@ -0,0 +1,28 @@
+#ifndef GITTEH_SHA1_H
+#define GITTEH_SHA1_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace gitteh {
+	/**
+		Plain SHA-1, for the checksums in pack and index files. Object ids
+		should keep coming from git_odb_hash, this is only for raw data.
+	*/
+	class Sha1 {
+	public:
+		Sha1();
+		void update(const void *data, size_t len);
+		void final(unsigned char digest[20]);
+
+	private:
+		void block(const unsigned char *data);
+
+		uint32_t state_[5];
+		uint64_t length_;
+		unsigned char buffer_[64];
+		size_t buffered_;
+	};
+}; // namespace gitteh
+
+#endif // GITTEH_SHA1_H
@@ -0,0 +1,379 @@
+#include "status.h"
+#include "repository.h"
+#include "workqueue.h"
+#include <algorithm>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+
+using std::vector;
+
+namespace gitteh {
+	namespace Status {
+		// How many tracked entries a single job stats/hashes.
+		static const size_t TRACKED_CHUNK_SIZE = 128;
+
+		// Mode of submodule entries in the index.
+		static const unsigned int GITLINK_MODE = 0160000;
+
+		enum {
+			PATHSPEC_NONE,
+			PATHSPEC_MATCH,
+			// Path is a parent directory of a pathspec, we need to look inside.
+			PATHSPEC_PARENT
+		};
+
+		struct TrackedEntry {
+			string path;
+			unsigned int mode;
+			git_off_t size;
+			git_time_t mtime;
+			git_time_t ctime;
+			unsigned int ino;
+			git_oid oid;
+			int status;
+		};
+
+		struct ScanState {
+			string workdir;
+			git_time_t indexMtime;
+			vector<string> pathspecs;
+
+			// Every path in the index, sorted. Used to tell untracked files
+			// apart and to decide which directories are worth descending.
+			vector<string> tracked;
+
+			// Only the entries that matched pathspecs, these get checked.
+			vector<TrackedEntry> entries;
+
+			vector<string> untracked;
+			gitteh_lock untrackedLock;
+
+			WorkQueue *queue;
+		};
+
+		struct TrackedJob {
+			ScanState *state;
+			size_t start;
+			size_t end;
+		};
+
+		struct DirectoryJob {
+			ScanState *state;
+			// Relative to workdir, either empty or with a trailing slash.
+			string path;
+		};
+
+		static int MatchPathspec(const vector<string> &specs, const string &path) {
+			if(specs.empty()) return PATHSPEC_MATCH;
+
+			int result = PATHSPEC_NONE;
+			for(size_t i = 0; i < specs.size(); i++) {
+				const string &spec = specs[i];
+				if(path.size() >= spec.size() && !path.compare(0, spec.size(), spec)
+						&& (path.size() == spec.size() || path[spec.size()] == '/')) {
+					return PATHSPEC_MATCH;
+				}
+				if(spec.size() > path.size() && !spec.compare(0, path.size(), path)
+						&& spec[path.size()] == '/') {
+					result = PATHSPEC_PARENT;
+				}
+			}
+			return result;
+		}
+
+		static bool IsTracked(ScanState *state, const string &path) {
+			return std::binary_search(state->tracked.begin(), state->tracked.end(),
+					path);
+		}
+
+		// dirPath must have a trailing slash.
+		static bool HasTrackedEntries(ScanState *state, const string &dirPath) {
+			vector<string>::const_iterator it = std::lower_bound(
+					state->tracked.begin(), state->tracked.end(), dirPath);
+			return it != state->tracked.end() &&
+					!it->compare(0, dirPath.size(), dirPath);
+		}
+
+		static unsigned int CanonicalMode(mode_t mode) {
+			if(S_ISLNK(mode)) return S_IFLNK;
+			return S_IFREG | ((mode & S_IXUSR) ? 0755 : 0644);
+		}
+
+		static bool HashWorkdirFile(const string &path, const struct stat &st,
+				git_oid *oid) {
+			if(S_ISLNK(st.st_mode)) {
+				vector<char> target(st.st_size + 1);
+				ssize_t len = readlink(path.c_str(), &target[0], target.size());
+				if(len < 0) return false;
+				return git_odb_hash(oid, &target[0], len, GIT_OBJ_BLOB) == GIT_OK;
+			}
+
+			return git_odb_hashfile(oid, path.c_str(), GIT_OBJ_BLOB) == GIT_OK;
+		}
+
+		static int CheckEntry(ScanState *state, TrackedEntry &entry) {
+			string fullPath = state->workdir + entry.path;
+			struct stat st;
+
+			if(lstat(fullPath.c_str(), &st) < 0 || S_ISDIR(st.st_mode)) {
+				return GIT_STATUS_WT_DELETED;
+			}
+
+			if(CanonicalMode(st.st_mode) != entry.mode) {
+				return GIT_STATUS_WT_MODIFIED;
+			}
+
+			// The index only keeps the low 32 bits of the size.
+			if((uint32_t)entry.size != (uint32_t)st.st_size) {
+				return GIT_STATUS_WT_MODIFIED;
+			}
+
+			// Stat data says nothing changed. Trust it, unless the file was
+			// touched in the same second the index was written ("racy git").
+			if(entry.mtime == (git_time_t)st.st_mtime &&
+					entry.ctime == (git_time_t)st.st_ctime &&
+					entry.ino == (unsigned int)st.st_ino &&
+					entry.mtime < state->indexMtime) {
+				return 0;
+			}
+
+			git_oid oid;
+			if(!HashWorkdirFile(fullPath, st, &oid)) {
+				return GIT_STATUS_WT_MODIFIED;
+			}
+			return git_oid_cmp(&oid, &entry.oid) ? GIT_STATUS_WT_MODIFIED : 0;
+		}
+
+		static void CheckTracked(void *data) {
+			TrackedJob *job = static_cast<TrackedJob*>(data);
+
+			// Each job owns a distinct slice of entries, no locking needed.
+			for(size_t i = job->start; i < job->end; i++) {
+				TrackedEntry &entry = job->state->entries[i];
+				entry.status = CheckEntry(job->state, entry);
+			}
+
+			delete job;
+		}
+
+		static bool IsDirectory(const string &fullPath, struct dirent *de) {
+#ifdef _DIRENT_HAVE_D_TYPE
+			if(de->d_type != DT_UNKNOWN) {
+				return de->d_type == DT_DIR;
+			}
+#endif
+			struct stat st;
+			if(lstat(fullPath.c_str(), &st) < 0) return false;
+			return S_ISDIR(st.st_mode);
+		}
+
+		static void ScanDirectory(void *data) {
+			DirectoryJob *job = static_cast<DirectoryJob*>(data);
+			ScanState *state = job->state;
+			string dirPath = state->workdir + job->path;
+
+			DIR *dir = opendir(dirPath.c_str());
+			if(dir == NULL) {
+				delete job;
+				return;
+			}
+
+			vector<string> found;
+			struct dirent *de;
+			while((de = readdir(dir)) != NULL) {
+				if(!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..") ||
+						!strcmp(de->d_name, ".git")) {
+					continue;
+				}
+
+				string path = job->path + de->d_name;
+				int match = MatchPathspec(state->pathspecs, path);
+				if(match == PATHSPEC_NONE) continue;
+
+				if(IsDirectory(dirPath + de->d_name, de)) {
+					string subdir = path + "/";
+
+					// Like git, a directory with nothing tracked in it is
+					// reported as a whole rather than walked.
+					if(match == PATHSPEC_PARENT || HasTrackedEntries(state, subdir)) {
+						DirectoryJob *subJob = new DirectoryJob;
+						subJob->state = state;
+						subJob->path = subdir;
+						state->queue->push(ScanDirectory, subJob);
+					}
+					else {
+						found.push_back(subdir);
+					}
+				}
+				else if(match == PATHSPEC_MATCH && !IsTracked(state, path)) {
+					found.push_back(path);
+				}
+			}
+			closedir(dir);
+
+			if(!found.empty()) {
+				LOCK_MUTEX(state->untrackedLock);
+				state->untracked.insert(state->untracked.end(), found.begin(),
+						found.end());
+				UNLOCK_MUTEX(state->untrackedLock);
+			}
+
+			delete job;
+		}
+
+		/**
+			Copies out the entries of index as it is in memory, which is
+			what JS sees as repo.index: re-reading it here would throw away
+			a readTree() that hasn't been written yet. Stat data is only
+			trusted for files last changed before the index file was.
+		*/
+		static bool SnapshotIndex(Repository *repo, git_index *index,
+				ScanState *state, Baton *baton) {
+			string indexPath = string(git_repository_path(repo->repo_)) + "index";
+			struct stat st;
+			state->indexMtime = stat(indexPath.c_str(), &st) < 0 ? 0 : st.st_mtime;
+
+			unsigned int count = git_index_entrycount(index);
+			state->tracked.reserve(count);
+			for(unsigned int i = 0; i < count; i++) {
+				git_index_entry *entry = git_index_get(index, i);
+				string path = string(entry->path);
+				state->tracked.push_back(path);
+
+				// Leave conflicted entries and submodules alone.
+				int stage = (entry->flags & GIT_IDXENTRY_STAGEMASK) >>
+						GIT_IDXENTRY_STAGESHIFT;
+				if(stage != 0 || (entry->mode & S_IFMT) == GITLINK_MODE) continue;
+				if(MatchPathspec(state->pathspecs, path) != PATHSPEC_MATCH) continue;
+
+				TrackedEntry tracked;
+				tracked.path = path;
+				tracked.mode = entry->mode;
+				tracked.size = entry->file_size;
+				tracked.mtime = entry->mtime.seconds;
+				tracked.ctime = entry->ctime.seconds;
+				tracked.ino = entry->ino;
+				tracked.oid = entry->oid;
+				tracked.status = 0;
+				state->entries.push_back(tracked);
+			}
+
+			std::sort(state->tracked.begin(), state->tracked.end());
+			return true;
+		}
+
+		static bool FilterIgnored(Repository *repo, ScanState *state,
+				Baton *baton) {
+			vector<string> kept;
+			for(size_t i = 0; i < state->untracked.size(); i++) {
+				string path = state->untracked[i];
+				if(path[path.size() - 1] == '/') {
+					path.resize(path.size() - 1);
+				}
+
+				int ignored = 0;
+				if(!AsyncLibCall(git_status_should_ignore(repo->repo_,
+						path.c_str(), &ignored), baton)) {
+					return false;
+				}
+				if(!ignored) kept.push_back(state->untracked[i]);
+			}
+			state->untracked.swap(kept);
+			return true;
+		}
+
+		void Init(Handle<Object> target) {
+			HandleScope scope;
+			Handle<Object> o = Object::New();
+			ImmutableSet(o, String::NewSymbol("new"), Integer::New(GIT_STATUS_WT_NEW));
+			ImmutableSet(o, String::NewSymbol("modified"), Integer::New(GIT_STATUS_WT_MODIFIED));
+			ImmutableSet(o, String::NewSymbol("deleted"), Integer::New(GIT_STATUS_WT_DELETED));
+			ImmutableSet(target, String::NewSymbol("statusFlags"), o);
+		}
+
+		bool Scan(Repository *repo, git_index *index,
+				const vector<string> &pathspecs, bool untracked, int threads,
+				Result *result, Baton *baton) {
+			const char *workdir = git_repository_workdir(repo->repo_);
+			if(workdir == NULL) {
+				baton->setError(GITERR_REPOSITORY,
+						"Cannot get status of a bare repository.");
+				return false;
+			}
+
+			ScanState state;
+			state.workdir = string(workdir);
+			for(size_t i = 0; i < pathspecs.size(); i++) {
+				string spec = pathspecs[i];
+				while(!spec.empty() && spec[spec.size() - 1] == '/') {
+					spec.resize(spec.size() - 1);
+				}
+				if(spec.empty()) {
+					// Root of the workdir, that's everything.
+					state.pathspecs.clear();
+					break;
+				}
+				state.pathspecs.push_back(spec);
+			}
+
+			repo->lockIndex();
+			bool ok = SnapshotIndex(repo, index, &state, baton);
+			repo->unlockIndex();
+			if(!ok) return false;
+
+			// Nothing below touches libgit2 state, only the filesystem.
+			WorkQueue queue(threads);
+			state.queue = &queue;
+			CREATE_MUTEX(state.untrackedLock);
+
+			for(size_t i = 0; i < state.entries.size(); i += TRACKED_CHUNK_SIZE) {
+				TrackedJob *job = new TrackedJob;
+				job->state = &state;
+				job->start = i;
+				job->end = std::min(i + TRACKED_CHUNK_SIZE, state.entries.size());
+				queue.push(CheckTracked, job);
+			}
+
+			if(untracked) {
+				DirectoryJob *job = new DirectoryJob;
+				job->state = &state;
+				queue.push(ScanDirectory, job);
+			}
+
+			queue.run();
+			DESTROY_MUTEX(state.untrackedLock);
+
+			if(!state.untracked.empty()) {
+				// Ignore rules come out of libgit2's attribute cache.
+				repo->lockConfig();
+				ok = FilterIgnored(repo, &state, baton);
+				repo->unlockConfig();
+				if(!ok) return false;
+			}
+
+			vector<std::pair<string, int> > changes;
+			for(size_t i = 0; i < state.entries.size(); i++) {
+				if(state.entries[i].status) {
+					changes.push_back(std::make_pair(state.entries[i].path,
+							state.entries[i].status));
+				}
+			}
+			for(size_t i = 0; i < state.untracked.size(); i++) {
+				changes.push_back(std::make_pair(state.untracked[i],
+						(int)GIT_STATUS_WT_NEW));
+			}
+			std::sort(changes.begin(), changes.end());
+
+			result->paths.reserve(changes.size());
+			result->flags.reserve(changes.size());
+			for(size_t i = 0; i < changes.size(); i++) {
+				result->paths.push_back(changes[i].first);
+				result->flags.push_back(changes[i].second);
+			}
+
+			return true;
+		}
+	};
+}; // namespace gitteh
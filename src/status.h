@@ -0,0 +1,36 @@
+#ifndef GITTEH_STATUS_H
+#define GITTEH_STATUS_H
+
+#include "gitteh.h"
+#include <vector>
+
+namespace gitteh {
+	class Repository;
+
+	namespace Status {
+		/**
+			Result of a status scan, kept as two parallel arrays so handing it
+			to JS doesn't cost an object per file. Sorted by path.
+		*/
+		struct Result {
+			std::vector<string> paths;
+			std::vector<int> flags;
+		};
+
+		void Init(Handle<Object>);
+
+		/**
+			Compares the index against the working directory of provided repo.
+			Tracked files are checked with the stat data cached in the index and
+			only hashed when that isn't conclusive. Stat'ing, hashing and the
+			untracked directory walk are spread over `threads` native threads.
+			Must be called from a worker thread, and without any repository lock
+			held (they're taken as needed). Returns false and errors out the baton
+			on failure.
+		*/
+		bool Scan(Repository*, git_index*, const std::vector<string> &pathspecs,
+				bool untracked, int threads, Result*, Baton*);
+	};
+}; // namespace gitteh
+
+#endif // GITTEH_STATUS_H
@@ -25,6 +25,43 @@ typedef pthread_mutex_t gitteh_lock;
 	
 #define UNLOCK_MUTEX(LOCK)													\
 	pthread_mutex_unlock(&LOCK)
+
+// Zero if the lock was taken, for the main thread, which mustn't wait.
+#define TRYLOCK_MUTEX(LOCK)													\
+	pthread_mutex_trylock(&LOCK)
 	
+typedef pthread_cond_t gitteh_cond;
+#define CREATE_COND(COND)													\
+	pthread_cond_init(&COND, NULL);
+
+#define DESTROY_COND(COND)													\
+	pthread_cond_destroy(&COND);
+
+#define WAIT_COND(COND, LOCK)												\
+	pthread_cond_wait(&COND, &LOCK);
+
+#define SIGNAL_COND(COND)													\
+	pthread_cond_signal(&COND);
+
+#define BROADCAST_COND(COND)												\
+	pthread_cond_broadcast(&COND);
+
+// Some operations (status, checkout) spread one request over several native
+// threads of their own rather than hogging more of the Scheduler's workers.
+typedef pthread_t gitteh_thread;
+#define CREATE_THREAD(THREAD, FN, ARG)											\
+	pthread_create(&THREAD, NULL, FN, ARG)
+
+#define JOIN_THREAD(THREAD)													\
+	pthread_join(THREAD, NULL);
+
+// Counters one thread bumps while another reports on them. Reads go through
+// the same locked instruction, so they never see a torn value.
+#define ATOMIC_READ(PTR)													\
+	__sync_fetch_and_add(PTR, 0)
+
+#define ATOMIC_ADD(PTR, VALUE)												\
+	__sync_fetch_and_add(PTR, VALUE)
+
 
 #endif // GITTEH_THREAD_H
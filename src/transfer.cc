@@ -0,0 +1,149 @@
+#include "transfer.h"
+#include "indexer.h"
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+
+using std::map;
+using std::vector;
+
+namespace gitteh {
+	namespace Transfer {
+		static bool Fail(Baton *baton, int code, const string &message) {
+			baton->setError(code, message);
+			return false;
+		}
+
+		bool LocalPath(const string &url, string *path) {
+			if(!url.compare(0, 7, "file://")) {
+				*path = url.substr(7);
+				return true;
+			}
+			// Anything else with a scheme, or scp style "host:path", isn't.
+			size_t colon = url.find(':');
+			if(colon != string::npos && url.find('/') > colon) return false;
+
+			struct stat st;
+			if(stat(url.c_str(), &st) < 0 || !S_ISDIR(st.st_mode)) return false;
+			*path = url;
+			return true;
+		}
+
+		bool ResolveRef(git_repository *repo, const char *name, git_oid *oid) {
+			git_reference *ref, *resolved;
+			if(git_reference_lookup(&ref, repo, name) != GIT_OK) return false;
+			bool ok = git_reference_resolve(&resolved, ref) == GIT_OK;
+			git_reference_free(ref);
+			if(!ok) return false;
+			git_oid_cpy(oid, git_reference_oid(resolved));
+			git_reference_free(resolved);
+			return true;
+		}
+
+		bool ListHeads(git_repository *repo, map<string, git_oid> *heads,
+				Baton *baton) {
+			git_oid oid;
+			// An unborn HEAD just isn't advertised.
+			if(ResolveRef(repo, "HEAD", &oid)) {
+				(*heads)["HEAD"] = oid;
+			}
+
+			git_strarray names;
+			if(git_reference_list(&names, repo, GIT_REF_LISTALL) != GIT_OK) {
+				baton->setError(giterr_last());
+				return false;
+			}
+			for(size_t i = 0; i < names.count; i++) {
+				if(ResolveRef(repo, names.strings[i], &oid)) {
+					(*heads)[names.strings[i]] = oid;
+				}
+			}
+			giterr_clear();
+			git_strarray_free(&names);
+			return true;
+		}
+
+		// Creates an empty temporary file to write a pack into.
+		static bool CreateTemp(const string &packDir, vector<char> *path,
+				int *fd, Baton *baton) {
+			// A freshly initialized repository may not have it yet.
+			mkdir(packDir.c_str(), 0777);
+
+			string tmpl = packDir + "/tmp_pack_XXXXXX";
+			path->assign(tmpl.begin(), tmpl.end());
+			path->push_back(0);
+			*fd = mkstemp(&(*path)[0]);
+			if(*fd < 0) {
+				return Fail(baton, GITERR_OS, "Failed to create a temporary "
+						"pack in '" + packDir + "'.");
+			}
+			return true;
+		}
+
+		// bytes, if set, is bumped (with ATOMIC_ADD) as the pack is written.
+		class FileSink : public Packer::Sink {
+		public:
+			FileSink(int fd, git_off_t *bytes) : fd_(fd), bytes_(bytes) { }
+
+			bool write(const char *data, size_t len) {
+				while(len > 0) {
+					ssize_t written = ::write(fd_, data, len);
+					if(written < 0) {
+						if(errno == EINTR) continue;
+						return false;
+					}
+					data += written;
+					len -= written;
+					if(bytes_) ATOMIC_ADD(bytes_, written);
+				}
+				return true;
+			}
+
+		private:
+			int fd_;
+			git_off_t *bytes_;
+		};
+
+		// Packs from repo, or if it's NULL from src, and installs the result.
+		static bool Install(Repository *repo, git_repository *src,
+				const Packer::Options &options, const string &packDir,
+				Progress *progress, git_off_t *bytes, Packer::Result *result,
+				Baton *baton) {
+			vector<char> path;
+			int fd;
+			if(!CreateTemp(packDir, &path, &fd, baton)) return false;
+
+			FileSink sink(fd, bytes);
+			bool ok = repo ?
+					Packer::Run(repo, options, &sink, progress, result, baton) :
+					Packer::Run(src, options, &sink, progress, result, baton);
+			if(close(fd) < 0 && ok) {
+				ok = Fail(baton, GITERR_OS, "Failed to write '" +
+						string(&path[0]) + "'.");
+			}
+
+			Indexer::Result indexed;
+			ok = ok && Indexer::Run(&path[0], packDir, options.threads, NULL,
+					&indexed, baton);
+			unlink(&path[0]);
+			return ok;
+		}
+
+		bool InstallPacked(Repository *repo, const Packer::Options &options,
+				const string &packDir, Progress *progress, Packer::Result *result,
+				Baton *baton) {
+			return Install(repo, NULL, options, packDir, progress, NULL, result,
+					baton);
+		}
+
+		bool InstallPacked(git_repository *src, const Packer::Options &options,
+				const string &packDir, git_off_t *bytes, Packer::Result *result,
+				Baton *baton) {
+			return Install(NULL, src, options, packDir, NULL, bytes, result,
+					baton);
+		}
+	};
+}; // namespace gitteh
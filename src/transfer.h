@@ -0,0 +1,51 @@
+#ifndef GITTEH_TRANSFER_H
+#define GITTEH_TRANSFER_H
+
+#include "gitteh.h"
+#include "packer.h"
+#include <map>
+#include <vector>
+
+namespace gitteh {
+	class Progress;
+
+	/**
+		Moving objects between two repositories on the same machine. libgit2
+		can't fetch from (or push to) a local path yet, so gitteh does it
+		itself: have the Packer write what the other side lacks into a pack
+		and let the Indexer install it.
+	*/
+	namespace Transfer {
+		// Repository path a remote url points at, if it's a local one (a
+		// plain path or a file:// url).
+		bool LocalPath(const string &url, string *path);
+
+		// What ref name ends up pointing at, following symbolic refs.
+		bool ResolveRef(git_repository*, const char *name, git_oid*);
+
+		// HEAD and every ref, resolved to the oid they end up at. This is
+		// what a remote would advertise.
+		bool ListHeads(git_repository*, std::map<string, git_oid>*, Baton*);
+
+		/**
+			Has the Packer write what repo has of options.wants, short of
+			options.haves, into a temporary file in packDir, then the Indexer
+			install it there. Deltas already in repo's packs are kept, and
+			both the compressing and the indexing happen on `options.threads`
+			threads. Only repo is read, under its own locks, the repository
+			packDir belongs to has to reload its object database afterwards
+			to see the new pack.
+		*/
+		bool InstallPacked(Repository *repo, const Packer::Options &options,
+				const string &packDir, Progress*, Packer::Result*, Baton*);
+
+		// Same, from a repository only the calling thread has open (the
+		// other side of a local fetch). bytes is bumped (with ATOMIC_ADD) as
+		// the pack is written, for progress sampling.
+		bool InstallPacked(git_repository *src, const Packer::Options &options,
+				const string &packDir, git_off_t *bytes, Packer::Result*,
+				Baton*);
+	};
+}; // namespace gitteh
+
+#endif // GITTEH_TRANSFER_H
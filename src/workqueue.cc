@@ -0,0 +1,86 @@
+#include "workqueue.h"
+#include <unistd.h>
+#include <vector>
+
+namespace gitteh {
+	static const int MAX_THREADS = 32;
+
+	WorkQueue::WorkQueue(int threads) : threads_(threads), active_(0) {
+		if(threads_ < 1) threads_ = DefaultThreads();
+		if(threads_ > MAX_THREADS) threads_ = MAX_THREADS;
+
+		CREATE_MUTEX(lock_);
+		CREATE_COND(cond_);
+	}
+
+	WorkQueue::~WorkQueue() {
+		DESTROY_COND(cond_);
+		DESTROY_MUTEX(lock_);
+	}
+
+	int WorkQueue::DefaultThreads() {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		if(cpus < 1) return 1;
+		if(cpus > MAX_THREADS) return MAX_THREADS;
+		return (int)cpus;
+	}
+
+	void WorkQueue::push(WorkFn fn, void *data) {
+		Job job = { fn, data };
+
+		LOCK_MUTEX(lock_);
+		jobs_.push_back(job);
+		SIGNAL_COND(cond_);
+		UNLOCK_MUTEX(lock_);
+	}
+
+	void WorkQueue::run() {
+		std::vector<gitteh_thread> threads;
+
+		for(int i = 1; i < threads_; i++) {
+			gitteh_thread thread;
+			if(CREATE_THREAD(thread, ThreadMain, this) == 0) {
+				threads.push_back(thread);
+			}
+		}
+
+		// Whatever happens with thread creation, the caller always works too,
+		// so the queue is guaranteed to drain.
+		work();
+
+		for(size_t i = 0; i < threads.size(); i++) {
+			JOIN_THREAD(threads[i]);
+		}
+	}
+
+	void *WorkQueue::ThreadMain(void *payload) {
+		static_cast<WorkQueue*>(payload)->work();
+		return NULL;
+	}
+
+	void WorkQueue::work() {
+		LOCK_MUTEX(lock_);
+		while(true) {
+			// A running job may still push more work, so only bail once the
+			// queue is empty *and* nobody is busy.
+			while(jobs_.empty() && active_ > 0) {
+				WAIT_COND(cond_, lock_);
+			}
+			if(jobs_.empty()) break;
+
+			Job job = jobs_.front();
+			jobs_.pop_front();
+			active_++;
+			UNLOCK_MUTEX(lock_);
+
+			job.fn(job.data);
+
+			LOCK_MUTEX(lock_);
+			active_--;
+			if(active_ == 0 && jobs_.empty()) {
+				BROADCAST_COND(cond_);
+			}
+		}
+		UNLOCK_MUTEX(lock_);
+	}
+}; // namespace gitteh
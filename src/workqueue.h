@@ -0,0 +1,48 @@
+#ifndef GITTEH_WORKQUEUE_H
+#define GITTEH_WORKQUEUE_H
+
+#include <deque>
+#include <pthread.h>
+#include "thread.h"
+
+namespace gitteh {
+	typedef void (*WorkFn)(void *data);
+
+	/**
+		A tiny pool of native threads for operations that want to spread a
+		single request across cores (stat'ing and hashing a workdir, writing
+		out a checkout, etc). Jobs are allowed to push more jobs while they run.
+		run() uses the calling thread as one of the workers and only returns
+		once the queue has been drained and every job has finished.
+
+		Jobs own their data, the queue never frees anything.
+	*/
+	class WorkQueue {
+	public:
+		WorkQueue(int threads);
+		~WorkQueue();
+
+		void push(WorkFn fn, void *data);
+		void run();
+
+		// Number of threads to use when the caller doesn't specify one.
+		static int DefaultThreads();
+
+	private:
+		struct Job {
+			WorkFn fn;
+			void *data;
+		};
+
+		std::deque<Job> jobs_;
+		int threads_;
+		int active_;
+		gitteh_lock lock_;
+		gitteh_cond cond_;
+
+		static void *ThreadMain(void*);
+		void work();
+	};
+}; // namespace gitteh
+
+#endif // GITTEH_WORKQUEUE_H